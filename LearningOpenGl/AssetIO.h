@@ -0,0 +1,566 @@
+#ifndef ASSET_IO_H
+#define ASSET_IO_H
+
+// define ASSET_IO_NO_URING to always use the thread pool backend
+#if defined(__linux__) && !defined(ASSET_IO_NO_URING)
+#define ASSET_IO_URING
+#endif
+
+#if defined(ASSET_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// higher priorities are handed to the disk first when more reads are queued than can be in flight
+enum AssetIOPriority {
+    ASSET_IO_LOW = 0,
+    ASSET_IO_NORMAL = 1,
+    ASSET_IO_HIGH = 2
+};
+
+// the whole contents of one finished read
+struct AssetReadResult {
+    uint64_t id = 0;
+    std::string path;
+    std::vector<unsigned char> data;
+    bool ok = false;
+};
+
+// Reads whole asset files asynchronously. Many reads can be queued at once; they are issued to the disk in
+// priority order and their buffers are handed back as they complete, so the caller can decode one file while
+// the others are still being read. On Linux the reads go through io_uring; if the kernel doesn't offer it (or on
+// other platforms) a small pool of threads doing blocking pread() calls takes over.
+//
+// Submit/Poll/Wait are meant to be called from a single thread.
+class AssetReader
+{
+public:
+    explicit AssetReader(unsigned int queueDepth = 64, unsigned int fallbackThreads = 4) : queueDepth(queueDepth)
+    {
+#if defined(ASSET_IO_URING)
+        if (setupRing())
+            return;
+#endif
+        startThreads(fallbackThreads);
+    }
+    ~AssetReader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+#if defined(ASSET_IO_URING)
+        destroyRing();
+#endif
+    }
+
+    AssetReader(const AssetReader&) = delete;
+    AssetReader& operator=(const AssetReader&) = delete;
+
+    // queues a read of the whole file at path and returns an id that identifies its result
+    uint64_t Submit(const std::string& path, AssetIOPriority priority = ASSET_IO_NORMAL)
+    {
+        Request request;
+        request.id = nextId++;
+        request.sequence = request.id;
+        request.priority = priority;
+        request.path = path;
+        outstanding++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push(std::move(request));
+        }
+        if (usingRing)
+        {
+#if defined(ASSET_IO_URING)
+            fillRing();
+#endif
+        }
+        else
+            workAvailable.notify_one();
+        return nextId - 1;
+    }
+
+    // hands back a finished read without blocking; returns false if none has completed yet
+    bool Poll(AssetReadResult& out)
+    {
+        return next(out, false);
+    }
+
+    // blocks until a read finishes and hands it back; returns false once nothing is outstanding
+    bool Wait(AssetReadResult& out)
+    {
+        return next(out, true);
+    }
+
+    // submits all paths at once and waits for every one of them; results come back in the order of paths
+    std::vector<AssetReadResult> ReadAll(const std::vector<std::string>& paths, AssetIOPriority priority = ASSET_IO_NORMAL)
+    {
+        std::vector<AssetReadResult> results(paths.size());
+        std::map<uint64_t, size_t> slots;
+        for (size_t i = 0; i < paths.size(); i++)
+            slots[Submit(paths[i], priority)] = i;
+        AssetReadResult result;
+        while (!slots.empty() && Wait(result))
+        {
+            auto slot = slots.find(result.id);
+            if (slot == slots.end())
+                continue;
+            results[slot->second] = std::move(result);
+            slots.erase(slot);
+        }
+        return results;
+    }
+
+    // number of submitted reads whose results haven't been handed back yet
+    size_t Outstanding() const { return outstanding; }
+    bool UsingIoUring() const { return usingRing; }
+
+private:
+    struct Request {
+        uint64_t id = 0;
+        uint64_t sequence = 0;
+        int priority = ASSET_IO_NORMAL;
+        std::string path;
+        std::vector<unsigned char> data;
+        size_t offset = 0;
+        int fd = -1;
+    };
+    struct ByPriority {
+        bool operator()(const Request& a, const Request& b) const
+        {
+            // highest priority first, then first come first served
+            if (a.priority != b.priority)
+                return a.priority < b.priority;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    unsigned int queueDepth;
+    uint64_t nextId = 1;
+    size_t outstanding = 0;
+    bool usingRing = false;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable resultAvailable;
+    std::priority_queue<Request, std::vector<Request>, ByPriority> queued;
+    std::deque<AssetReadResult> completed;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    bool next(AssetReadResult& out, bool block)
+    {
+        if (outstanding == 0)
+            return false;
+        if (usingRing)
+        {
+#if defined(ASSET_IO_URING)
+            reapRing(block);
+#endif
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if (block)
+            resultAvailable.wait(lock, [this] { return !completed.empty(); });
+        if (completed.empty())
+            return false;
+        out = std::move(completed.front());
+        completed.pop_front();
+        outstanding--;
+        return true;
+    }
+
+    // must be called with mutex held
+    void complete(Request& request, bool ok)
+    {
+        AssetReadResult result;
+        result.id = request.id;
+        result.path = std::move(request.path);
+        result.data = std::move(request.data);
+        result.ok = ok;
+        if (!ok)
+            result.data.clear();
+        completed.push_back(std::move(result));
+    }
+
+    // thread pool fallback
+    // ------------------------------------------------------------------------
+    void startThreads(unsigned int count)
+    {
+        for (unsigned int i = 0; i < std::max(1u, count); i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this] { return stopping || !queued.empty(); });
+                if (stopping)
+                    return;
+                request = queued.top();
+                queued.pop();
+            }
+            bool ok = readBlocking(request);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                complete(request, ok);
+            }
+            resultAvailable.notify_one();
+        }
+    }
+
+    static bool readBlocking(Request& request)
+    {
+#ifdef _WIN32
+        std::ifstream file(request.path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        request.data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(request.data.data()), (std::streamsize)request.data.size());
+        return (bool)file;
+#else
+        int fd = ::open(request.path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        request.data.resize(static_cast<size_t>(st.st_size));
+        while (request.offset < request.data.size())
+        {
+            ssize_t n = pread(fd, request.data.data() + request.offset, request.data.size() - request.offset, (off_t)request.offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            request.offset += (size_t)n;
+        }
+        ::close(fd);
+        request.data.resize(request.offset);
+        return request.offset == static_cast<size_t>(st.st_size);
+#endif
+    }
+
+#if defined(ASSET_IO_URING)
+    // io_uring backend
+    // ------------------------------------------------------------------------
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    std::map<uint64_t, Request> inFlight;
+    unsigned int toSubmit = 0;
+
+    bool setupRing()
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, queueDepth, &params);
+        if (ringFd < 0)
+            return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            sqRing = nullptr;
+            destroyRing();
+            return false;
+        }
+        if (singleMap)
+            cqRing = sqRing;
+        else
+        {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+            {
+                cqRing = nullptr;
+                destroyRing();
+                return false;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqeMapping == MAP_FAILED)
+        {
+            destroyRing();
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqeMapping);
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        if (!ringSupportsRead())
+        {
+            destroyRing();
+            return false;
+        }
+        // never keep more reads in flight than the completion ring can hold
+        queueDepth = std::min(params.sq_entries, params.cq_entries);
+        usingRing = true;
+        return true;
+    }
+
+    // IORING_OP_READ only exists from Linux 5.6 on, the same release that added opcode probing, so a ring
+    // that can't be probed can't read either and the thread pool is used instead
+    bool ringSupportsRead()
+    {
+        constexpr unsigned opCount = 256;
+        std::vector<unsigned char> storage(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, opCount) < 0)
+            return false;
+        return IORING_OP_READ <= probe->last_op && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    void destroyRing()
+    {
+        drainRing();
+        if (sqes != nullptr)
+            munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr)
+            munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            ::close(ringFd);
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        ringFd = -1;
+    }
+
+    // cancels every read still on the ring and waits for all of their completions; until a read's completion
+    // arrives the kernel may still be writing into its buffer, so neither the buffer nor its fd can be freed before
+    void drainRing()
+    {
+        if (inFlight.empty())
+            return;
+        submitRing(false);
+        for (auto& entry : inFlight)
+            queueCancel(entry.first);
+        while (!inFlight.empty() && submitRing(true))
+        {
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++)
+            {
+                // the cancels' own completions don't match anything in flight and are skipped here
+                auto entry = inFlight.find(cqes[head & *cqMask].user_data);
+                if (entry == inFlight.end())
+                    continue;
+                ::close(entry->second.fd);
+                inFlight.erase(entry);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        // the ring is broken and the reads left can't be waited for: leak their buffers rather than free memory
+        // the kernel may still write to
+        for (auto& entry : inFlight)
+            new std::vector<unsigned char>(std::move(entry.second.data));
+        inFlight.clear();
+    }
+
+    // opens queued files and puts their first read on the ring, highest priority first, while there is room
+    void fillRing()
+    {
+        while (inFlight.size() < queueDepth)
+        {
+            Request request;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (queued.empty())
+                    break;
+                request = queued.top();
+                queued.pop();
+            }
+            request.fd = ::open(request.path.c_str(), O_RDONLY);
+            struct stat st;
+            if (request.fd < 0 || fstat(request.fd, &st) != 0)
+            {
+                if (request.fd >= 0)
+                    ::close(request.fd);
+                std::lock_guard<std::mutex> lock(mutex);
+                complete(request, false);
+                continue;
+            }
+            request.data.resize(static_cast<size_t>(st.st_size));
+            if (request.data.empty())
+            {
+                ::close(request.fd);
+                std::lock_guard<std::mutex> lock(mutex);
+                complete(request, true);
+                continue;
+            }
+            uint64_t id = request.id;
+            queueRead(inFlight.emplace(id, std::move(request)).first->second);
+        }
+        submitRing(false);
+    }
+
+    // writes a read of the rest of request's file into the next free submission queue entry
+    void queueRead(Request& request)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = request.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(request.data.data() + request.offset);
+        // a single read is capped at what the kernel will transfer in one go; longer files are resubmitted
+        sqe->len = (uint32_t)std::min<size_t>(request.data.size() - request.offset, 0x7ffff000);
+        sqe->off = request.offset;
+        sqe->user_data = request.id;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+
+    // asks the kernel to cancel the read tagged with id; the cancel's own completion is tagged so it can't
+    // be mistaken for a read's
+    void queueCancel(uint64_t id)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = id;
+        sqe->user_data = id | CANCEL_TAG;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+    static constexpr uint64_t CANCEL_TAG = 1ull << 63;
+
+    // returns false if the ring refused the call for any reason other than an interrupt
+    bool submitRing(bool waitForOne)
+    {
+        unsigned flags = waitForOne ? IORING_ENTER_GETEVENTS : 0;
+        if (toSubmit == 0 && !waitForOne)
+            return true;
+        int submitted;
+        do
+            submitted = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, waitForOne ? 1u : 0u, flags, nullptr, 0);
+        while (submitted < 0 && errno == EINTR);
+        if (submitted > 0)
+            toSubmit -= std::min<unsigned>(toSubmit, (unsigned)submitted);
+        return submitted >= 0;
+    }
+
+    // moves every completion off the ring, resubmitting short reads, then tops the ring up from the queue
+    void reapRing(bool block)
+    {
+        for (;;)
+        {
+            bool finishedAny = false;
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++)
+            {
+                io_uring_cqe* cqe = &cqes[head & *cqMask];
+                auto entry = inFlight.find(cqe->user_data);
+                if (entry == inFlight.end())
+                    continue;
+                Request& request = entry->second;
+                int res = cqe->res;
+                if (res == -EINTR || res == -EAGAIN)
+                {
+                    queueRead(request);
+                    continue;
+                }
+                if (res > 0)
+                    request.offset += (size_t)res;
+                if (res > 0 && request.offset < request.data.size())
+                {
+                    queueRead(request);
+                    continue;
+                }
+                ::close(request.fd);
+                // a read the ring rejects outright gets a second chance through a plain blocking read
+                bool ok = res >= 0 && request.offset == request.data.size();
+                if (res == -EINVAL)
+                    ok = readBlocking(request);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    complete(request, ok);
+                }
+                inFlight.erase(entry);
+                finishedAny = true;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            fillRing();
+
+            bool haveResult;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                haveResult = !completed.empty();
+            }
+            if (!block || haveResult || finishedAny || inFlight.empty())
+                return;
+            submitRing(true);
+        }
+    }
+#endif
+};
+
+// process-wide reader for small batches that are waited on straight away, like the stages of one shader
+inline AssetReader& SharedAssetReader()
+{
+    static AssetReader reader;
+    return reader;
+}
+#endif
@@ -0,0 +1,159 @@
+#ifndef GL_LOADER_THREAD_H
+#define GL_LOADER_THREAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// A thread with its own GL context that shares objects (buffers, textures, shaders, syncs) with the render context.
+// Work queued on it runs there, so creating and filling GL objects never takes time from the frame loop. After each
+// job the loader fences its commands; once the render thread's Poll() sees the fence signalled, it runs the job's
+// onReady callback, from which the finished objects can be used. Container objects like vertex arrays are not shared
+// between contexts and have to be created on the render thread, e.g. from onReady or lazily on first draw.
+//
+// The context is handed in as callbacks, so the same loader runs on a GLFW window (see CreateLoaderThread) or a
+// headless EGL context.
+class GLLoaderThread
+{
+public:
+    // makeCurrent/releaseCurrent are called on the loader thread; destroyContext from the destructor's thread once
+    // the loader has stopped
+    GLLoaderThread(std::function<void()> makeCurrent, std::function<void()> releaseCurrent, std::function<void()> destroyContext = {})
+        : destroyContext(std::move(destroyContext))
+    {
+        thread = std::thread([this, makeCurrent, releaseCurrent] {
+            makeCurrent();
+            workerLoop();
+            releaseCurrent();
+        });
+    }
+    // waits for the job in progress, drops the ones not started yet. Call with the render context current.
+    ~GLLoaderThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        thread.join();
+        for (Finished& job : finished)
+            glDeleteSync(job.fence);
+        for (Finished& job : handedOver)
+            glDeleteSync(job.fence);
+        if (destroyContext)
+            destroyContext();
+    }
+
+    GLLoaderThread(const GLLoaderThread&) = delete;
+    GLLoaderThread& operator=(const GLLoaderThread&) = delete;
+
+    // runs work on the loader context, then onReady on the render thread (from Poll) once the GPU has executed it
+    void Enqueue(std::function<void()> work, std::function<void()> onReady = {})
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back({ std::move(work), std::move(onReady) });
+        }
+        workAvailable.notify_one();
+    }
+
+    // call once per frame on the render thread: runs onReady for every finished job, in the order they were queued
+    void Poll()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!finished.empty())
+            {
+                handedOver.push_back(std::move(finished.front()));
+                finished.pop_front();
+            }
+        }
+        while (!handedOver.empty())
+        {
+            GLenum status = glClientWaitSync(handedOver.front().fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+                break;
+            Finished job = std::move(handedOver.front());
+            handedOver.pop_front();
+            glDeleteSync(job.fence);
+            if (job.onReady)
+                job.onReady();
+        }
+    }
+
+    // whether every queued job has finished and been handed over by Poll
+    bool IsIdle()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queued.empty() && !working && finished.empty() && handedOver.empty();
+    }
+
+private:
+    struct Job {
+        std::function<void()> work;
+        std::function<void()> onReady;
+    };
+    struct Finished {
+        GLsync fence;
+        std::function<void()> onReady;
+    };
+
+    std::thread thread;
+    std::function<void()> destroyContext;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::deque<Job> queued;
+    std::deque<Finished> finished;      // filled by the loader, emptied by Poll
+    std::deque<Finished> handedOver;    // render thread only: waiting for their fence
+    bool working = false;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this] { return stopping || !queued.empty(); });
+                if (stopping)
+                    return;
+                job = std::move(queued.front());
+                queued.pop_front();
+                working = true;
+            }
+            job.work();
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // without a flush the fence might never reach the GPU, and the render thread would wait on it forever
+            glFlush();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back({ fence, std::move(job.onReady) });
+                working = false;
+            }
+        }
+    }
+};
+
+// creates a hidden window whose context shares objects with share (using the current window hints, so it gets the same
+// GL version) and starts a loader thread on it. Like every GLFW window function this must be called on the main
+// thread. Returns null if the window can't be created.
+inline std::unique_ptr<GLLoaderThread> CreateLoaderThread(GLFWwindow* share)
+{
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* context = glfwCreateWindow(1, 1, "loader", NULL, share);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (context == NULL)
+        return nullptr;
+    return std::make_unique<GLLoaderThread>(
+        [context] { glfwMakeContextCurrent(context); },
+        [] { glfwMakeContextCurrent(NULL); },
+        [context] { glfwDestroyWindow(context); });
+}
+#endif
@@ -0,0 +1,283 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+// calls GLStateCache passed on to GL and calls it dropped because GL was already in that state
+struct GLStateStats
+{
+    uint64_t issued = 0;
+    uint64_t skipped = 0;
+};
+
+// Remembers the binding state it last set on a context (current program, vertex array, active texture unit, the
+// textures bound to each unit and the buffers bound to each target) and drops the calls that wouldn't change it.
+// That only works if every bind of the tracked state goes through the cache; code that binds behind its back, or a
+// different context being made current on the thread, needs an Invalidate() afterwards.
+//
+// Since the state only changes when something else is bound, nothing needs to be unbound after use any more: leaving
+// a texture or buffer bound is what lets the next identical bind be skipped. The exceptions are GL_PIXEL_PACK_BUFFER
+// and GL_PIXEL_UNPACK_BUFFER, which turn the pointers of texture uploads and reads into buffer offsets, so they still
+// go back to 0 after use. Objects have to be deleted through the cache, since GL reuses the names of deleted objects.
+//
+// Programs, textures and buffers are shared between the contexts of a share group, so a delete on one thread can
+// free a name another thread's cache still has bound; GL may then hand it out again and a bind of the new object
+// would be skipped. Every delete therefore bumps a process-wide count, and a cache that sees the count move forgets
+// which of those objects it has bound (vertex arrays and the active unit are per context and stay).
+class GLStateCache
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 32;
+
+    GLStateCache()
+    {
+        Invalidate();
+    }
+
+    void UseProgram(GLuint program)
+    {
+        syncDeletions();
+        if (change(this->program, program))
+            glUseProgram(program);
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (change(this->vertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // unit is the index of the texture unit, not GL_TEXTURE0 + index
+    void ActiveTexture(GLuint unit)
+    {
+        if (change(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds to the active unit, e.g. to upload into the texture
+    void BindTexture(GLenum target, GLuint texture)
+    {
+        syncDeletions();
+        GLuint* bound = textureSlot(activeUnit, target);
+        if (bound == nullptr)
+        {
+            stats.issued++;
+            glBindTexture(target, texture);
+        }
+        else if (change(*bound, texture))
+            glBindTexture(target, texture);
+    }
+
+    // binds to a unit for sampling, switching the active unit only if the texture isn't already there
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        syncDeletions();
+        GLuint* bound = textureSlot(unit, target);
+        if (bound != nullptr && *bound == texture)
+        {
+            stats.skipped++;
+            return;
+        }
+        ActiveTexture(unit);
+        BindTexture(target, texture);
+    }
+
+    // not for GL_ELEMENT_ARRAY_BUFFER: that binding belongs to the bound vertex array, see BindElementBuffer
+    void BindBuffer(GLenum target, GLuint buffer)
+    {
+        syncDeletions();
+        GLuint& bound = bufferSlot(target);
+        if (change(bound, buffer))
+            glBindBuffer(target, buffer);
+    }
+
+    // binds the element buffer of the bound vertex array. That binding is part of the vertex array's state, which is
+    // only ever set up once, so the call always goes to GL.
+    void BindElementBuffer(GLuint buffer)
+    {
+        stats.issued++;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    }
+
+    // indexed binds also bind the buffer to target itself, as GL does
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        BindBufferRange(target, index, buffer, 0, -1);
+    }
+
+    // size -1 stands for the whole buffer (glBindBufferBase)
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        syncDeletions();
+        bufferSlot(target) = buffer;
+        IndexedBuffer wanted{ buffer, offset, size };
+        auto bound = indexedBuffers.find({ target, index });
+        if (bound != indexedBuffers.end() && bound->second == wanted)
+        {
+            stats.skipped++;
+            return;
+        }
+        indexedBuffers[{ target, index }] = wanted;
+        stats.issued++;
+        if (size < 0)
+            glBindBufferBase(target, index, buffer);
+        else
+            glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    void DeleteProgram(GLuint program)
+    {
+        if (this->program == program)
+            this->program = UNKNOWN;
+        glDeleteProgram(program);
+        noteDeletion();
+    }
+
+    void DeleteTexture(GLuint texture)
+    {
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+            for (GLuint& bound : textures[unit])
+                if (bound == texture)
+                    bound = 0;
+        glDeleteTextures(1, &texture);
+        noteDeletion();
+    }
+
+    void DeleteBuffer(GLuint buffer)
+    {
+        for (auto& bound : buffers)
+            if (bound.second == buffer)
+                bound.second = 0;
+        for (auto bound = indexedBuffers.begin(); bound != indexedBuffers.end();)
+            bound = bound->second.buffer == buffer ? indexedBuffers.erase(bound) : std::next(bound);
+        glDeleteBuffers(1, &buffer);
+        noteDeletion();
+    }
+
+    // forgets everything, so the next call of each kind goes to GL
+    void Invalidate()
+    {
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        forgetSharedObjects();
+        seenDeletions = deletions().load(std::memory_order_acquire);
+    }
+
+    // the calls of the frame so far; the render loop starts each frame with BeginFrame()
+    GLStateStats FrameStats() const
+    {
+        return stats;
+    }
+    void BeginFrame()
+    {
+        stats = {};
+    }
+
+private:
+    static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;
+    // the texture targets tracked per unit; binds to any other target always go to GL
+    static const int TRACKED_TEXTURE_TARGETS = 4;
+
+    struct IndexedBuffer {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+
+        bool operator==(const IndexedBuffer& other) const
+        {
+            return buffer == other.buffer && offset == other.offset && size == other.size;
+        }
+    };
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TRACKED_TEXTURE_TARGETS];
+    std::map<GLenum, GLuint> buffers;
+    std::map<std::pair<GLenum, GLuint>, IndexedBuffer> indexedBuffers;
+    GLStateStats stats;
+    uint64_t seenDeletions = 0;     // deletions() as of the last time this cache was known to be up to date
+
+    // deletes made through any thread's cache so far
+    static std::atomic<uint64_t>& deletions()
+    {
+        static std::atomic<uint64_t> count{ 0 };
+        return count;
+    }
+
+    // after one of our own deletes (whose names were already dropped above): if nobody else deleted anything since we
+    // last looked, we are still up to date
+    void noteDeletion()
+    {
+        uint64_t previous = deletions().fetch_add(1, std::memory_order_acq_rel);
+        if (previous == seenDeletions)
+            seenDeletions = previous + 1;
+    }
+
+    // forgets the shared objects bound here if another thread deleted something since we last looked
+    void syncDeletions()
+    {
+        uint64_t count = deletions().load(std::memory_order_acquire);
+        if (count == seenDeletions)
+            return;
+        forgetSharedObjects();
+        seenDeletions = count;
+    }
+
+    void forgetSharedObjects()
+    {
+        program = UNKNOWN;
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+            for (GLuint& bound : textures[unit])
+                bound = UNKNOWN;
+        buffers.clear();
+        indexedBuffers.clear();
+    }
+
+    // records value as the new state and returns whether that is a change GL has to hear about
+    bool change(GLuint& state, GLuint value)
+    {
+        if (state == value)
+        {
+            stats.skipped++;
+            return false;
+        }
+        state = value;
+        stats.issued++;
+        return true;
+    }
+
+    GLuint* textureSlot(GLuint unit, GLenum target)
+    {
+        int index;
+        switch (target)
+        {
+        case GL_TEXTURE_2D: index = 0; break;
+        case GL_TEXTURE_2D_ARRAY: index = 1; break;
+        case GL_TEXTURE_CUBE_MAP: index = 2; break;
+        case GL_TEXTURE_3D: index = 3; break;
+        default: return nullptr;
+        }
+        return unit < (GLuint)MAX_TEXTURE_UNITS ? &textures[unit][index] : nullptr;
+    }
+
+    GLuint& bufferSlot(GLenum target)
+    {
+        return buffers.try_emplace(target, UNKNOWN).first->second;
+    }
+};
+
+// the cache of the context current on the calling thread. Every thread here has one context of its own (the render
+// thread the window's, a GLLoaderThread its shared one), so the cache is per thread as well; deletes on any of them
+// reach the others as described above.
+inline GLStateCache& GLState()
+{
+    static thread_local GLStateCache state;
+    return state;
+}
+#endif
@@ -0,0 +1,110 @@
+// Decodes the bundled JPGs with each set of SIMD kernels stb_image has (C, SSE2/NEON and AVX2) forced in turn,
+// checks that they all produce the same pixels and prints how long each took. Not part of the
+// LearningOpenGl build, as it has a main of its own; build it on its own with optimizations on, e.g.
+//
+//     g++ -O2 -std=c++20 JpegDecodeBenchmark.cpp -o JpegDecodeBenchmark
+//     cl /O2 /std:c++20 /EHsc JpegDecodeBenchmark.cpp
+//
+// and run it from this directory, or pass the images to decode on the command line.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+struct DecodedImage {
+    std::vector<unsigned char> pixels;
+    int width = 0, height = 0, components = 0;
+};
+
+const char* SimdLevelName(int level)
+{
+    switch (level)
+    {
+    case STBI_SIMD_NONE: return "C";
+    case STBI_SIMD_BASELINE: return "SSE2/NEON";
+    default: return "AVX2";
+    }
+}
+
+// decodes encoded repeats times with the given kernels; returns the fastest time in milliseconds and the pixels
+double TimeDecode(const std::vector<unsigned char>& encoded, int repeats, DecodedImage& decoded)
+{
+    double best = 1e30;
+    for (int i = 0; i < repeats; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned char* data = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &decoded.width, &decoded.height, &decoded.components, 0);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!data)
+            return -1.0;
+        best = std::min(best, ms);
+        decoded.pixels.assign(data, data + (size_t)decoded.width * decoded.height * decoded.components);
+        stbi_image_free(data);
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty())
+        paths = { "container.jpg", "matrix.jpg", "huh.jpg", "math.jpg", "pepe.jpg" };
+    const int repeats = 20;
+
+    bool allMatch = true;
+    for (const std::string& path : paths)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (encoded.empty())
+        {
+            std::printf("%s: can't read\n", path.c_str());
+            continue;
+        }
+
+        // every level is compared with the first one that ran, normally the C kernels
+        DecodedImage reference;
+        int referenceLevel = -1;
+        std::printf("%s\n", path.c_str());
+        for (int limit = STBI_SIMD_NONE; limit <= STBI_SIMD_AVX2; limit++)
+        {
+            int level = stbi_set_jpeg_simd_limit(limit);
+            if (level != limit)
+            {
+                std::printf("  %-10s not available, skipped\n", SimdLevelName(limit));
+                continue;
+            }
+            DecodedImage decoded;
+            double ms = TimeDecode(encoded, repeats, decoded);
+            if (ms < 0.0)
+            {
+                std::printf("  %-10s decode failed: %s\n", SimdLevelName(level), stbi_failure_reason());
+                allMatch = false;
+                continue;
+            }
+            std::string match;
+            if (referenceLevel < 0)
+            {
+                reference = decoded;
+                referenceLevel = level;
+            }
+            else if (decoded.pixels == reference.pixels)
+                match = std::string(", same pixels as ") + SimdLevelName(referenceLevel);
+            else
+            {
+                match = std::string(", PIXELS DIFFER from ") + SimdLevelName(referenceLevel);
+                allMatch = false;
+            }
+            std::printf("  %-10s %dx%dx%d  %8.3f ms%s\n", SimdLevelName(level), decoded.width, decoded.height,
+                        decoded.components, ms, match.c_str());
+        }
+    }
+    stbi_set_jpeg_simd_limit(STBI_SIMD_AVX2);
+    return allMatch ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#ifndef LIGHTING_UNIFORMS_H
+#define LIGHTING_UNIFORMS_H
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Std140.h"
+
+// The lights of lighting.glsl (included by colors.fs). They live in the std140 block
+//
+//     layout (std140) uniform Lights {
+//         DirLight dirLight;
+//         PointLight pointLights[NR_POINT_LIGHTS];
+//         SpotLight spotLight;
+//     };
+//
+// which is mirrored by LightsBlock below and uploaded in one go through a LightsBuffer bound to LIGHTS_BLOCK_BINDING.
+// Run ValidateStd140Block<LightsBlock>(shader.ID, "Lights") after linking to catch the two sides drifting apart.
+
+// must match NR_POINT_LIGHTS in lighting.glsl
+const int NR_POINT_LIGHTS = 4;
+
+struct DirLight {
+    glm::vec3 direction;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct PointLight {
+    glm::vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct SpotLight {
+    glm::vec3 position;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct LightsBlock {
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
+
+template <> struct Std140Layout<DirLight> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(DirLight, direction),
+        STD140_MEMBER(DirLight, ambient), STD140_MEMBER(DirLight, diffuse), STD140_MEMBER(DirLight, specular));
+};
+template <> struct Std140Layout<PointLight> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(PointLight, position),
+        STD140_MEMBER(PointLight, constant), STD140_MEMBER(PointLight, linear), STD140_MEMBER(PointLight, quadratic),
+        STD140_MEMBER(PointLight, ambient), STD140_MEMBER(PointLight, diffuse), STD140_MEMBER(PointLight, specular));
+};
+template <> struct Std140Layout<SpotLight> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(SpotLight, position), STD140_MEMBER(SpotLight, direction),
+        STD140_MEMBER(SpotLight, cutOff), STD140_MEMBER(SpotLight, outerCutOff),
+        STD140_MEMBER(SpotLight, constant), STD140_MEMBER(SpotLight, linear), STD140_MEMBER(SpotLight, quadratic),
+        STD140_MEMBER(SpotLight, ambient), STD140_MEMBER(SpotLight, diffuse), STD140_MEMBER(SpotLight, specular));
+};
+template <> struct Std140Layout<LightsBlock> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(LightsBlock, dirLight), STD140_MEMBER(LightsBlock, pointLights), STD140_MEMBER(LightsBlock, spotLight));
+};
+
+// the offsets lighting.glsl's structs get under std140; ValidateStd140Block checks the same against the linker at runtime
+static_assert(Std140Offsets<DirLight>() == std::array<size_t, 4>{ 0, 16, 32, 48 } && Std140Size<DirLight> == 64);
+static_assert(Std140Offsets<PointLight>() == std::array<size_t, 7>{ 0, 12, 16, 20, 32, 48, 64 } && Std140Size<PointLight> == 80);
+static_assert(Std140Offsets<SpotLight>() == std::array<size_t, 10>{ 0, 16, 28, 32, 36, 40, 44, 48, 64, 80 } && Std140Size<SpotLight> == 96);
+static_assert(Std140Offsets<LightsBlock>() == std::array<size_t, 3>{ 0, 64, 384 } && Std140Size<LightsBlock> == 480);
+
+class LightsBuffer : public Std140Buffer<LightsBlock>
+{
+public:
+    LightsBuffer() : Std140Buffer<LightsBlock>(LIGHTS_BLOCK_BINDING) {}
+};
+
+// Typed handles for the remaining plain uniforms of colors.fs, resolved once after the program is linked
+struct LightingUniforms {
+    UniformHandle<int> materialDiffuse, materialSpecular;
+    UniformHandle<float> materialShininess;
+
+    void Resolve(const Shader& shader)
+    {
+        materialDiffuse = shader.uniform<int>("material.diffuse");
+        materialSpecular = shader.uniform<int>("material.specular");
+        materialShininess = shader.uniform<float>("material.shininess");
+    }
+};
+
+// for programs that still take their transform as plain uniforms rather than the Frame and Object blocks
+struct TransformUniforms {
+    UniformHandle<glm::mat4> model, view, projection;
+
+    void Resolve(const Shader& shader)
+    {
+        model = shader.uniform<glm::mat4>("model");
+        view = shader.uniform<glm::mat4>("view");
+        projection = shader.uniform<glm::mat4>("projection");
+    }
+};
+#endif
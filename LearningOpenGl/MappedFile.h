@@ -0,0 +1,202 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A read-only view of a whole file mapped into the address space. The kernel pages the contents in
+// on demand, so callers can read straight from Data() without an intermediate heap copy.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    explicit MappedFile(const std::string& path)
+    {
+        Open(path);
+    }
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+    {
+        moveFrom(other);
+    }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    // maps the file at path, replacing any previous mapping. Returns false if the file can't be opened or mapped.
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize))
+        {
+            Close();
+            return false;
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        opened = true;
+        // an empty file can't be mapped, but it is still a valid (empty) view
+        if (size == 0)
+            return true;
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL)
+        {
+            Close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (bytes == nullptr)
+        {
+            Close();
+            return false;
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            Close();
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        opened = true;
+        // an empty file can't be mapped, but it is still a valid (empty) view
+        if (size == 0)
+            return true;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(mapping);
+        // decoders walk the file front to back, so let the kernel read ahead aggressively
+        madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    // asks the kernel to start reading the whole file in the background; returns immediately
+    void Prefetch() const
+    {
+        if (bytes == nullptr)
+            return;
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range = { const_cast<unsigned char*>(bytes), size };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        madvise(const_cast<unsigned char*>(bytes), size, MADV_WILLNEED);
+#endif
+    }
+
+    // unmaps the file and releases its handles
+    void Close()
+    {
+#ifdef _WIN32
+        if (bytes != nullptr)
+            UnmapViewOfFile(bytes);
+        if (mappingHandle != NULL)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (bytes != nullptr)
+            munmap(const_cast<unsigned char*>(bytes), size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        size = 0;
+        opened = false;
+    }
+
+    const unsigned char* Data() const { return bytes; }
+    size_t Size() const { return size; }
+    bool IsOpen() const { return opened; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+#else
+    int fd = -1;
+#endif
+
+    void moveFrom(MappedFile& other)
+    {
+        bytes = other.bytes;
+        size = other.size;
+        opened = other.opened;
+#ifdef _WIN32
+        fileHandle = other.fileHandle;
+        mappingHandle = other.mappingHandle;
+        other.fileHandle = INVALID_HANDLE_VALUE;
+        other.mappingHandle = NULL;
+#else
+        fd = other.fd;
+        other.fd = -1;
+#endif
+        other.bytes = nullptr;
+        other.size = 0;
+        other.opened = false;
+    }
+};
+
+// starts background readahead for a whole batch of mapped files (e.g. every texture of one material) in one go,
+// so the decodes that follow find their input already in the page cache instead of faulting it in file by file.
+inline void PrefetchFiles(const std::vector<const MappedFile*>& files)
+{
+#ifdef _WIN32
+    std::vector<WIN32_MEMORY_RANGE_ENTRY> ranges;
+    for (const MappedFile* file : files)
+        if (file->Data() != nullptr)
+            ranges.push_back({ const_cast<unsigned char*>(file->Data()), file->Size() });
+    if (!ranges.empty())
+        PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+#else
+    for (const MappedFile* file : files)
+        file->Prefetch();
+#endif
+}
+#endif
@@ -11,17 +11,104 @@
 
 #include "stb_image.h"
 #include "mesh.h"
+#include "RenderQueue.h"
 #include "shader.h"
+#include "TextureCache.h"
+#include "TextureArray.h"
+#include "AssetIO.h"
+#include "WorkerPool.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
+// texture loading settings. A model copies textureLoadOptions when its load starts and reads only that copy, so a load
+// running on a loader thread never sees the settings change halfway.
+struct TextureLoadOptions {
+    TextureDecodeOptions decode;            // flip/mipmap settings; these are part of the texture cache key
+    bool useDiskCache = true;               // reuse decoded texels from earlier runs instead of decoding again
+    bool useAssetReader = true;             // read all of a model's textures up front through one AssetReader batch
+    bool parallelDecode = true;             // spread the IDCT, colour conversion and flip of large images over SharedWorkerPool()
+    string cacheDirectory = "texture_cache";
+
+    // resolution budget, for machines with little video memory. Textures over budget are uploaded from a smaller mip
+    // level when they have one, or halved on the CPU otherwise. The disk cache always keeps full resolution.
+    int maxTextureSize = 0;                 // largest width/height uploaded for any texture, 0 = no limit
+    map<string, int> maxTextureSizeByType;  // per texture type limits that replace maxTextureSize, e.g. {"texture_normal", 1024}
+    size_t textureMemoryBudget = 0;         // total bytes every uploaded texture may take together, 0 = no limit
+    int minTextureSize = 64;                // textureMemoryBudget never halves a texture below this size
+
+    // pack each model's textures into GL_TEXTURE_2D_ARRAYs (see TextureArrayPacker). Shaders then declare every
+    // texture_diffuseN etc. as a sampler2DArray plus an int texture_diffuseN_layer; lighting.glsl does when built
+    // with TextureShaderDefines().
+    bool packTextureArrays = false;
+};
+inline TextureLoadOptions textureLoadOptions;
+
+// the #defines of the programs that draw models loaded with options: TEXTURE_ARRAYS (see lighting.glsl) when their
+// textures are packed into arrays
+inline ShaderDefines TextureShaderDefines(const TextureLoadOptions& options = textureLoadOptions)
+{
+    ShaderDefines defines;
+    if (options.packTextureArrays)
+        defines.Define("TEXTURE_ARRAYS");
+    return defines;
+}
+// bytes of texel data uploaded so far, checked against textureMemoryBudget. Loads on several threads book into it;
+// only loads with a budget set do, and DeleteTexture hands a texture's bytes back.
+inline std::atomic<size_t> textureMemoryUsed{ 0 };
+// what each texture (or packed texture array) booked into textureMemoryUsed, by name
+inline std::mutex textureMemoryMutex;
+inline map<unsigned int, size_t> textureMemoryBooked;
+
+// the memory a texture's levels point into, kept alive until they have been uploaded
+struct TextureSource {
+    CachedTexture cached;
+    vector<unsigned char> storage;
+    vector<unsigned char> scratch;
+    TextureLevels levels;           // the levels to upload
+    size_t bookedBytes = 0;         // what levels booked into textureMemoryUsed
+    // when nothing but the upload needs the mip chain, only stb_image's base level is kept (levels.levels[0] points
+    // into it) and UploadTexture builds levels 1.. on its way into the upload
+    unique_ptr<unsigned char, void (*)(void*)> decoded{ nullptr, stbi_image_free };
+    bool mipsPending = false;
+};
+
+// records that textureID holds bytes booked into textureMemoryUsed, to be released when it is deleted
+inline void BookTextureMemory(unsigned int textureID, size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    std::lock_guard<std::mutex> lock(textureMemoryMutex);
+    textureMemoryBooked[textureID] += bytes;
+}
+
+// deletes a texture (or texture array) loaded by the functions below and hands its bytes back to textureMemoryBudget
+inline void DeleteTexture(unsigned int textureID)
+{
+    GLState().DeleteTexture(textureID);
+    std::lock_guard<std::mutex> lock(textureMemoryMutex);
+    auto booked = textureMemoryBooked.find(textureID);
+    if (booked == textureMemoryBooked.end())
+        return;
+    textureMemoryUsed -= booked->second;
+    textureMemoryBooked.erase(booked);
+}
+
+shared_ptr<TextureSource> DecodeTextureSource(const unsigned char* encoded, size_t size, const string& typeName, const TextureLoadOptions& loadOptions,
+                                              bool mipsOnUpload = false);
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false, const string& typeName = "",
+                             const TextureLoadOptions& loadOptions = textureLoadOptions);
+unsigned int TextureFromMemory(const unsigned char* encoded, size_t size, const char* path, bool gamma = false, const string& typeName = "",
+                               const TextureLoadOptions& loadOptions = textureLoadOptions);
 
 class Model
 {
@@ -33,19 +120,117 @@ public:
     bool gammaCorrection;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false) : gammaCorrection(gamma), loadOptions(textureLoadOptions)
     {
         loadModel(path);
     }
 
+    // empty model, filled in later by Load (e.g. as a job on a GLLoaderThread)
+    Model() : gammaCorrection(false)
+    {
+    }
+
+    // loads a model from file into this (so far empty) model. On a loader thread, pass a copy of textureLoadOptions
+    // taken on the thread that sets them.
+    void Load(string const& path, const TextureLoadOptions& options = textureLoadOptions)
+    {
+        loadOptions = options;
+        loadModel(path);
+    }
+
     // draws the model, and thus all its meshes
     void Draw(Shader& shader)
     {
+        // with packed textures the arrays are bound once up front and each mesh only picks its layers
+        for (unsigned int i = 0; i < boundArrays.size(); i++)
+            GLState().BindTexture(i, GL_TEXTURE_2D_ARRAY, boundArrays[i]);
         for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            meshes[i].Draw(shader, boundArrays);
+    }
+
+    // draws one copy of the model per transform with a single draw per mesh. The program must take the model and
+    // normal matrices from the per-instance attributes (build it with INSTANCED defined, see colors.vs) rather than
+    // the Object block.
+    void DrawInstanced(Shader& shader, std::span<const glm::mat4> transforms)
+    {
+        if (transforms.empty())
+            return;
+        instances.resize(transforms.size());
+        for (size_t i = 0; i < transforms.size(); i++)
+        {
+            instances[i].model = transforms[i];
+            instances[i].normalMatrix = glm::transpose(glm::inverse(glm::mat3(transforms[i])));
+        }
+        size_t bytes = instances.size() * sizeof(InstanceData);
+
+        if (instanceBuffer == 0)
+            glGenBuffers(1, &instanceBuffer);
+        GLState().BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        // fresh storage every call, so the copy never waits for the previous call's draws to finish reading
+        glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+
+        for (unsigned int i = 0; i < boundArrays.size(); i++)
+            GLState().BindTexture(i, GL_TEXTURE_2D_ARRAY, boundArrays[i]);
+        for (Mesh& mesh : meshes)
+            mesh.DrawInstanced(shader, boundArrays, instanceBuffer, (GLsizei)transforms.size());
+    }
+
+    // deletes the buffer of DrawInstanced, e.g. once the model stops being drawn instanced; the next call makes a new one
+    void ReleaseInstanceBuffer()
+    {
+        if (instanceBuffer == 0)
+            return;
+        GLState().DeleteBuffer(instanceBuffer);
+        instanceBuffer = 0;
+        for (Mesh& mesh : meshes)
+            mesh.ForgetInstanceBuffer();
+    }
+
+    // deletes every texture and texture array of the model, releasing their share of textureMemoryBudget; the
+    // meshes are drawn untextured afterwards
+    void ReleaseTextures()
+    {
+        for (Texture& texture : textures_loaded)
+            if (texture.layer < 0 && texture.id != 0)
+                DeleteTexture(texture.id);
+        for (unsigned int array : textureArrays)
+            DeleteTexture(array);
+        textures_loaded.clear();
+        textureArrays.clear();
+        boundArrays.clear();
+        for (Mesh& mesh : meshes)
+            mesh.textures.clear();
+    }
+
+    // queues every mesh, placed by model, instead of drawing right away; the queue's Flush draws them sorted
+    // together with those of other models
+    void Submit(RenderQueue& queue, Shader& shader, const glm::mat4& model, RenderPass pass = RENDER_PASS_OPAQUE)
+    {
+        for (Mesh& mesh : meshes)
+            queue.Add(shader, mesh, model, &boundArrays, pass);
     }
 
 private:
+    // texture arrays bound for the whole model; any beyond this are bound by the meshes using them
+    static const size_t MAX_BOUND_TEXTURE_ARRAYS = 8;
+
+    // the textureLoadOptions our load started with
+    TextureLoadOptions loadOptions;
+    // the arrays packTextureArrays built for this model
+    vector<unsigned int> textureArrays;
+    // the first MAX_BOUND_TEXTURE_ARRAYS of them
+    vector<unsigned int> boundArrays;
+    // the per-instance data of DrawInstanced, created by its first call, and where it is put together
+    unsigned int instanceBuffer = 0;
+    vector<InstanceData> instances;
+    // decoded textures waiting for packTextureArrays, keyed by path
+    map<string, shared_ptr<TextureSource>> unpackedTextures;
+    // mapped texture files waiting to be decoded, keyed by their path relative to the model directory
+    map<string, MappedFile> prefetchedTextures;
+    // textures already decoded by preloadSceneTextures, keyed the same way
+    map<string, unsigned int> preloadedTextures;
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const& path)
     {
@@ -61,8 +246,59 @@ private:
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
+        // read every texture the scene references in one batch before walking the node tree
+        if (loadOptions.useAssetReader)
+            preloadSceneTextures(scene);
+
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        if (loadOptions.packTextureArrays)
+            packTextureArrays();
+    }
+
+    // decodes and uploads one texture. With packTextureArrays its texels are kept for packTextureArrays instead and
+    // 0 is returned; the real name is filled in once the arrays are built.
+    unsigned int loadTexture(const unsigned char* encoded, size_t size, const string& path, const string& typeName)
+    {
+        if (!loadOptions.packTextureArrays)
+            return TextureFromMemory(encoded, size, path.c_str(), gammaCorrection, typeName, loadOptions);
+        shared_ptr<TextureSource> source = DecodeTextureSource(encoded, size, typeName, loadOptions);
+        if (source)
+            unpackedTextures[path] = source;
+        else
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+        return 0;
+    }
+
+    // packs every texture loaded by loadTexture into texture arrays and points all of our textures at their layer
+    void packTextureArrays()
+    {
+        TextureArrayPacker packer;
+        map<string, int> packed;
+        for (auto& entry : unpackedTextures)
+            packed[entry.first] = packer.Add(entry.second->levels);
+        vector<unsigned int> arrays = packer.Build(loadOptions.decode.generateMipmaps);
+        textureArrays.insert(textureArrays.end(), arrays.begin(), arrays.end());
+        boundArrays.assign(textureArrays.begin(), textureArrays.begin() + std::min<size_t>(textureArrays.size(), MAX_BOUND_TEXTURE_ARRAYS));
+        // each array now holds what its textures booked
+        for (auto& entry : unpackedTextures)
+            BookTextureMemory(packer.Placement(packed[entry.first]).array, entry.second->bookedBytes);
+        unpackedTextures.clear();
+
+        auto place = [&](Texture& texture) {
+            auto it = packed.find(texture.path);
+            if (it == packed.end())
+                return;
+            TextureArrayLayer placement = packer.Placement(it->second);
+            texture.id = placement.array;
+            texture.layer = placement.layer;
+        };
+        for (Texture& texture : textures_loaded)
+            place(texture);
+        for (Mesh& mesh : meshes)
+            for (Texture& texture : mesh.textures)
+                place(texture);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -144,6 +380,8 @@ private:
         }
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+        // get the disk reading every texture of this material before the first one is decoded
+        prefetchMaterialTextures(material);
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
         // Same applies to other texture as the following list summarizes:
@@ -152,26 +390,98 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE);
         textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, TEXTURE_SPECULAR);
         textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, TEXTURE_NORMAL);
         textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, TEXTURE_HEIGHT);
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
         // return a mesh object created from the extracted mesh data
         return Mesh(vertices, indices, textures);
     }
 
+    // submits every texture referenced by any material of the scene to an AssetReader at once, so the disk works
+    // through all of them while each finished file is decoded and uploaded as soon as its bytes land. Diffuse maps
+    // are read first since they're what's needed to see anything.
+    void preloadSceneTextures(const aiScene* scene)
+    {
+        const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+        const AssetIOPriority priorities[] = { ASSET_IO_HIGH, ASSET_IO_NORMAL, ASSET_IO_LOW, ASSET_IO_LOW };
+        const TextureType textureTypes[] = { TEXTURE_DIFFUSE, TEXTURE_SPECULAR, TEXTURE_NORMAL, TEXTURE_HEIGHT };
+        AssetReader reader;
+        map<uint64_t, pair<string, string>> requests;
+        map<string, bool> requested;
+        for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+        {
+            aiMaterial* mat = scene->mMaterials[m];
+            for (int t = 0; t < 4; t++)
+            {
+                for (unsigned int i = 0; i < mat->GetTextureCount(types[t]); i++)
+                {
+                    aiString str;
+                    mat->GetTexture(types[t], i, &str);
+                    string path = str.C_Str();
+                    if (requested[path] || isTextureLoaded(path) || preloadedTextures.count(path))
+                        continue;
+                    requested[path] = true;
+                    requests[reader.Submit(this->directory + '/' + path, priorities[t])] = { path, TextureTypeName(textureTypes[t]) };
+                }
+            }
+        }
+
+        AssetReadResult result;
+        while (reader.Wait(result))
+        {
+            const string& path = requests[result.id].first;
+            if (result.ok)
+                preloadedTextures[path] = loadTexture(result.data.data(), result.data.size(), path, requests[result.id].second);
+        }
+    }
+
+    // maps every texture of a material that hasn't been loaded yet and starts readahead on all of them as one batch.
+    // loadMaterialTextures then decodes straight out of these mappings.
+    void prefetchMaterialTextures(aiMaterial* mat)
+    {
+        const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+        vector<const MappedFile*> batch;
+        for (aiTextureType type : types)
+        {
+            for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+            {
+                aiString str;
+                mat->GetTexture(type, i, &str);
+                string path = str.C_Str();
+                if (isTextureLoaded(path) || prefetchedTextures.count(path) || preloadedTextures.count(path))
+                    continue;
+                MappedFile& file = prefetchedTextures[path];
+                if (file.Open(this->directory + '/' + path))
+                    batch.push_back(&file);
+                else
+                    prefetchedTextures.erase(path);
+            }
+        }
+        PrefetchFiles(batch);
+    }
+
+    bool isTextureLoaded(const string& path) const
+    {
+        for (unsigned int j = 0; j < textures_loaded.size(); j++)
+            if (textures_loaded[j].path == path)
+                return true;
+        return false;
+    }
+
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
     // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, TextureType textureType)
     {
+        string typeName = TextureTypeName(textureType);
         vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
@@ -191,8 +501,26 @@ private:
             if (!skip)
             {   // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
+                auto preloaded = preloadedTextures.find(str.C_Str());
+                auto prefetched = prefetchedTextures.find(str.C_Str());
+                if (preloaded != preloadedTextures.end())
+                {
+                    texture.id = preloaded->second;
+                    preloadedTextures.erase(preloaded);
+                }
+                else if (prefetched != prefetchedTextures.end())
+                {
+                    texture.id = loadTexture(prefetched->second.Data(), prefetched->second.Size(), str.C_Str(), typeName);
+                    prefetchedTextures.erase(prefetched);
+                }
+                else if (loadOptions.packTextureArrays)
+                {
+                    MappedFile file(this->directory + '/' + str.C_Str());
+                    texture.id = loadTexture(file.Data(), file.Size(), str.C_Str(), typeName);
+                }
+                else
+                    texture.id = TextureFromFile(str.C_Str(), this->directory, false, typeName, loadOptions);
+                texture.type = textureType;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
@@ -203,41 +531,246 @@ private:
 };
 
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+// uploads every level of a decoded texture into the currently bound GL_TEXTURE_2D
+void UploadTextureLevels(const TextureLevels& levels)
+{
+    GLenum format = TextureFormat(levels.components);
+
+    // rows of 1 and 3 component levels aren't 4 byte aligned in general
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < levels.levelCount; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, format, levels.LevelWidth(level), levels.LevelHeight(level), 0, format, GL_UNSIGNED_BYTE, levels.levels[level]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels.levelCount - 1);
+}
+
+// writes source's levels back to back into dst. Pending mips are built on the way: each level is halved from the one
+// before into a small scratch buffer and copied from there, as dst may be mapped memory that is slow to read back.
+void CopyTextureLevels(const TextureSource& source, unsigned char* dst)
+{
+    const TextureLevels& levels = source.levels;
+    if (!source.mipsPending)
+    {
+        for (int level = 0; level < levels.levelCount; level++)
+        {
+            std::memcpy(dst, levels.levels[level], levels.LevelSize(level));
+            dst += levels.LevelSize(level);
+        }
+        return;
+    }
+    std::memcpy(dst, levels.levels[0], levels.LevelSize(0));
+    dst += levels.LevelSize(0);
+    if (levels.levelCount < 2)
+        return;
+    // odd levels go to the first half and even ones to the second, each no bigger than level 1 or 2
+    vector<unsigned char> scratch(levels.LevelSize(1) + (levels.levelCount > 2 ? levels.LevelSize(2) : 0));
+    unsigned char* halves[2] = { scratch.data(), scratch.data() + levels.LevelSize(1) };
+    const unsigned char* src = levels.levels[0];
+    for (int level = 1; level < levels.levelCount; level++)
+    {
+        unsigned char* half = halves[(level - 1) & 1];
+        HalveImage(src, levels.LevelWidth(level - 1), levels.LevelHeight(level - 1), levels.components, half);
+        std::memcpy(dst, half, levels.LevelSize(level));
+        dst += levels.LevelSize(level);
+        src = half;
+    }
+}
+
+// uploads source's levels into textureID, which must be bound to GL_TEXTURE_2D. With an activeUploadStream the
+// upload is queued instead: when their frame comes the levels are copied into its staging ring, straight from the
+// mapped cache file on a cache hit, and from stb_image's output with the mips built on the way for a fresh decode
+// that isn't cached.
+void UploadTexture(unsigned int textureID, shared_ptr<TextureSource> source)
+{
+    if (activeUploadStream == nullptr)
+    {
+        if (source->mipsPending)
+        {
+            TextureLevels& levels = source->levels;
+            BuildMipChain(levels.levels[0], levels.width, levels.height, levels.components, levels.levelCount > 1, source->storage, levels);
+            source->mipsPending = false;
+        }
+        UploadTextureLevels(source->levels);
+        return;
+    }
+    size_t size = 0;
+    for (int level = 0; level < source->levels.levelCount; level++)
+        size += source->levels.LevelSize(level);
+    activeUploadStream->Queue(size,
+        [source](unsigned char* dst) { CopyTextureLevels(*source, dst); },
+        [source, textureID](const unsigned char* src, bool staged) {
+            // same layout as the fill above, with the levels now read from src
+            TextureLevels levels = source->levels;
+            for (int level = 0; level < levels.levelCount; level++)
+            {
+                levels.levels[level] = src;
+                src += levels.LevelSize(level);
+            }
+            GLState().BindTexture(GL_TEXTURE_2D, textureID);
+            UploadTextureLevels(levels);
+        });
+}
+
+// picks the levels of a texture to upload under the resolution budget for typeName and, if there is a memory budget,
+// books their size into textureMemoryUsed and booked. Mip levels below the base are reused when levels has them;
+// otherwise the smallest level there is gets halved into scratch.
+TextureLevels FitTextureBudget(const TextureLevels& levels, const string& typeName, vector<unsigned char>& scratch,
+                               const TextureLoadOptions& options, size_t& booked)
+{
+    int maxSize = options.maxTextureSize;
+    auto typeLimit = options.maxTextureSizeByType.find(typeName);
+    if (typeLimit != options.maxTextureSizeByType.end())
+        maxSize = typeLimit->second;
+
+    auto largestSide = [&](int skip) { return std::max(levels.LevelWidth(skip), levels.LevelHeight(skip)); };
+    // bytes uploaded when skipping the first skip levels; a chain without mips stays a single level
+    auto uploadSize = [&](int skip) {
+        size_t bytes = levels.LevelSize(skip);
+        for (int level = skip + 1; level < levels.levelCount; level++)
+            bytes += levels.LevelSize(level);
+        return bytes;
+    };
+
+    int sizeSkip = 0;
+    while (maxSize > 0 && largestSide(sizeSkip) > maxSize)
+        sizeSkip++;
+    // another thread may book its texture between our reading what's used and adding ours; then decide again
+    int skip = sizeSkip;
+    booked = 0;
+    if (options.textureMemoryBudget > 0)
+    {
+        size_t used = textureMemoryUsed.load();
+        do
+        {
+            skip = sizeSkip;
+            while (used + uploadSize(skip) > options.textureMemoryBudget &&
+                   largestSide(skip) > 1 && largestSide(skip) / 2 >= options.minTextureSize)
+                skip++;
+        } while (!textureMemoryUsed.compare_exchange_weak(used, used + uploadSize(skip)));
+        booked = uploadSize(skip);
+    }
+
+    if (skip < levels.levelCount)
+        return levels.DropLevels(skip);
+
+    // past the end of the chain: keep halving its last level until we reach the size we want
+    int level = levels.levelCount - 1;
+    size_t total = 0;
+    for (int next = level + 1; next <= skip; next++)
+        total += levels.LevelSize(next);
+    scratch.resize(total);
+    const unsigned char* src = levels.levels[level];
+    unsigned char* dst = scratch.data();
+    for (; level < skip; level++)
+    {
+        HalveImage(src, levels.LevelWidth(level), levels.LevelHeight(level), levels.components, dst);
+        src = dst;
+        dst += levels.LevelSize(level + 1);
+    }
+    TextureLevels fitted;
+    fitted.width = levels.LevelWidth(skip);
+    fitted.height = levels.LevelHeight(skip);
+    fitted.components = levels.components;
+    fitted.levelCount = 1;
+    fitted.levels[0] = src;
+    return fitted;
+}
+
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma, const string& typeName,
+                             const TextureLoadOptions& loadOptions)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    // map the encoded file instead of reading it through stdio: stb_image decodes straight from the page cache
+    MappedFile file(filename);
+    if (!file.IsOpen())
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return textureID;
+    }
+    return TextureFromMemory(file.Data(), file.Size(), path, gamma, typeName, loadOptions);
+}
+
+// lets stb_image hand its row ranges to the shared worker pool
+static void StbParallelFor(void* user, stbi_parallel_task* task, void* context, int count)
+{
+    static_cast<WorkerPool*>(user)->ParallelFor(count, [&](int begin, int end) { task(context, begin, end); });
+}
+
+// decodes (or fetches from the texture cache) an encoded image that's already in memory and fits it to the texture
+// budget for typeName. Returns null if the image can't be decoded. With mipsOnUpload, a source that will only ever be
+// passed to UploadTexture may leave its mips for the upload to build.
+shared_ptr<TextureSource> DecodeTextureSource(const unsigned char* encoded, size_t size, const string& typeName, const TextureLoadOptions& loadOptions,
+                                              bool mipsOnUpload)
+{
+    const TextureDecodeOptions& options = loadOptions.decode;
+    TextureCache cache(loadOptions.cacheDirectory);
+    uint64_t key = TextureCacheKey(encoded, size, options);
+
+    // warm start: the decoded mip chain is uploaded straight out of the mapped cache file
+    auto source = make_shared<TextureSource>();
+    if (loadOptions.useDiskCache && cache.Load(key, source->cached))
+    {
+        source->levels = FitTextureBudget(source->cached.levels, typeName, source->scratch, loadOptions, source->bookedBytes);
+        return source;
+    }
 
     int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    // stb_image's own setters are process-wide; these only apply to decodes on this thread
+    stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+    stbi_set_parallel_for_thread(loadOptions.parallelDecode ? StbParallelFor : nullptr, &SharedWorkerPool(), 0);
+    unsigned char* data = stbi_load_from_memory(encoded, (int)size, &width, &height, &nrComponents, 0);
+    if (!data)
+        return nullptr;
+
+    // without the disk cache or a budget that could drop levels, the upload is the only reader of the mip chain
+    bool budgeted = loadOptions.maxTextureSize > 0 || !loadOptions.maxTextureSizeByType.empty() || loadOptions.textureMemoryBudget > 0;
+    if (mipsOnUpload && !loadOptions.useDiskCache && !budgeted)
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+        source->decoded.reset(data);
+        source->levels.width = width;
+        source->levels.height = height;
+        source->levels.components = nrComponents;
+        source->levels.levelCount = options.generateMipmaps ? MipLevelCount(width, height) : 1;
+        source->levels.levels[0] = data;
+        source->mipsPending = true;
+        return source;
+    }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    TextureLevels levels;
+    BuildMipChain(data, width, height, nrComponents, options.generateMipmaps, source->storage, levels);
+    stbi_image_free(data);
 
+    source->levels = FitTextureBudget(levels, typeName, source->scratch, loadOptions, source->bookedBytes);
+    if (loadOptions.useDiskCache)
+        cache.Store(key, levels);
+    return source;
+}
+
+// decodes an encoded image that's already in memory into a new texture; path is only used for messages
+unsigned int TextureFromMemory(const unsigned char* encoded, size_t size, const char* path, bool gamma, const string& typeName,
+                               const TextureLoadOptions& loadOptions)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    shared_ptr<TextureSource> source = DecodeTextureSource(encoded, size, typeName, loadOptions, true);
+    if (source)
+    {
+        BookTextureMemory(textureID, source->bookedBytes);
+        GLState().BindTexture(GL_TEXTURE_2D, textureID);
+        UploadTexture(textureID, source);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, loadOptions.decode.generateMipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
     }
     else
     {
         std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
 
     return textureID;
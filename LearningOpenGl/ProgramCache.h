@@ -0,0 +1,152 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "MappedFile.h"
+#include "TextureCache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+// Persistent cache of linked program binaries (glGetProgramBinary), so a program whose sources haven't changed since
+// the last run is loaded in one file read instead of being compiled and linked again. Entries are keyed by the hashes
+// ShaderSourceCache already keeps of each stage's files, the injected #defines and the driver's vendor, renderer and
+// version strings, so a lookup doesn't hash the expanded source text a second time; a driver update or a different GPU
+// simply misses. A binary the driver refuses anyway is treated as a miss as well, and the caller compiles from source
+// and stores the fresh binary over it.
+class ProgramCache
+{
+public:
+    std::string directory;
+
+    explicit ProgramCache(std::string directory = "shader_cache") : directory(std::move(directory))
+    {
+    }
+
+    // whether the current context can save and load program binaries at all
+    static bool Supported()
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // key for a program built from stages with these ExpandedSource hashes (in stage order) and the text of the defines
+    // injected into each of them, on the current context's driver
+    static uint64_t Key(const std::vector<uint64_t>& stageHashes, const std::string& defines)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (GLenum name : strings)
+        {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if (value != nullptr)
+                hash = HashBytes(value, std::strlen(value), hash);
+        }
+        // the count keeps a program without a geometry stage apart from one with
+        uint64_t count = stageHashes.size();
+        hash = HashBytes(&count, sizeof(count), hash);
+        hash = HashBytes(stageHashes.data(), stageHashes.size() * sizeof(uint64_t), hash);
+        return HashBytes(defines.data(), defines.size(), hash);
+    }
+
+    // loads the binary stored for key into program. Returns false on a miss or if the driver rejects the binary, in
+    // which case program is left unlinked and can be built from source as usual.
+    bool Load(uint64_t key, GLuint program) const
+    {
+        MappedFile file;
+        if (!file.Open(entryPath(key)) || file.Size() < sizeof(Header))
+            return false;
+        Header header;
+        std::memcpy(&header, file.Data(), sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.key != key ||
+            header.length != file.Size() - sizeof(Header))
+            return false;
+
+        glProgramBinary(program, header.format, file.Data() + sizeof(Header), (GLsizei)header.length);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked == GL_TRUE;
+    }
+
+    // stores the binary of a successfully linked program as the entry for key. Like TextureCache, the entry is written
+    // to a temporary file and renamed into place.
+    bool Store(uint64_t key, GLuint program) const
+    {
+        GLint linked = GL_FALSE, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (linked != GL_TRUE || length <= 0)
+            return false;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        Header header;
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, MAGIC, 4);
+        header.version = VERSION;
+        header.format = format;
+        header.key = key;
+        header.length = (uint64_t)length;
+
+        std::string path = entryPath(key);
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            file.write(binary.data(), length);
+            if (!file)
+            {
+                std::cout << "ERROR::PROGRAM_CACHE::FILE_NOT_SUCCESSFULLY_WRITTEN: " << tempPath << std::endl;
+                file.close();
+                std::filesystem::remove(tempPath, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tempPath, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr const char* MAGIC = "PGB1";
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t format;
+        uint32_t reserved;
+        uint64_t key;
+        uint64_t length;
+    };
+
+    std::string entryPath(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return directory + '/' + name;
+    }
+};
+
+// the cache every Shader goes through
+inline ProgramCache& SharedProgramCache()
+{
+    static ProgramCache cache;
+    return cache;
+}
+#endif
@@ -0,0 +1,279 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+#include "mesh.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+enum RenderPass {
+    RENDER_PASS_OPAQUE,         // drawn first, sorted by state and then front to back
+    RENDER_PASS_TRANSPARENT     // drawn after the opaque pass, back to front
+};
+
+// a sort key and the index of the draw it belongs to
+struct RenderSortEntry {
+    uint64_t key;
+    uint32_t draw;
+};
+
+// least significant digit first radix sort of entries by key, on 8 bit digits; stable, so draws with equal keys keep
+// the order they were queued in. Digits every key has in common (most of the high ones, usually) are skipped.
+// scratch is resized to match.
+constexpr void RadixSortKeys(std::vector<RenderSortEntry>& entries, std::vector<RenderSortEntry>& scratch)
+{
+    scratch.resize(entries.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[256] = {};
+        for (const RenderSortEntry& entry : entries)
+            counts[(entry.key >> shift) & 0xFF]++;
+        if (counts[(entries.empty() ? 0 : entries[0].key >> shift) & 0xFF] == entries.size())
+            continue;
+        size_t offset = 0;
+        for (size_t& count : counts)
+        {
+            size_t digits = count;
+            count = offset;
+            offset += digits;
+        }
+        for (const RenderSortEntry& entry : entries)
+            scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+        entries.swap(scratch);
+    }
+}
+
+// Collects a frame's mesh draws and submits them sorted, so draws that share a program, textures and vertex array
+// follow each other (which GLStateCache then turns into skipped binds) instead of coming in whatever order the
+// models were imported. Every draw is reduced to a 64-bit key, most significant bits first:
+//
+//     opaque:       pass (2) | program (10) | material (16) | vertex array (16) | depth (20)
+//     transparent:  pass (2) | far-to-near depth (20) | program (10) | material (16) | vertex array (16)
+//
+// and the keys are radix sorted. Within one state opaque draws go front to back, so early depth testing rejects as
+// much of what lies behind as possible; transparent ones must blend back to front, so their depth comes first.
+// Program and material are numbered in the order they are first seen each frame, which keeps them small enough.
+class RenderQueue
+{
+public:
+    // sets up the object transform for the draws that follow, e.g. ObjectUniforms::Bind plus a plain model uniform.
+    // Called whenever the program or the object changes.
+    typedef std::function<void(Shader&, const glm::mat4&)> TransformFunction;
+
+    // starts collecting a frame. view and farPlane are those of the camera, to turn distances into depth keys.
+    void Begin(const glm::mat4& view, float farPlane)
+    {
+        this->view = view;
+        this->farPlane = farPlane;
+        draws.clear();
+        keys.clear();
+        objects.clear();
+        programs.clear();
+        materials.clear();
+    }
+
+    // queues mesh, placed by model, to be drawn with shader. boundArrays are the texture arrays of its model (see
+    // Mesh::Draw); they have to stay alive until Flush.
+    void Add(Shader& shader, Mesh& mesh, const glm::mat4& model, const std::vector<unsigned int>* boundArrays = nullptr,
+             RenderPass pass = RENDER_PASS_OPAQUE)
+    {
+        if (objects.empty() || objects.back() != model)
+            objects.push_back(model);
+        // distance along the view direction of the mesh's centre, scaled to the 20 bits of the key
+        float distance = -(view * model * glm::vec4(mesh.center, 1.0f)).z;
+        uint64_t depth = (uint64_t)(std::clamp(distance / farPlane, 0.0f, 1.0f) * float(DEPTH_MAX));
+        uint64_t program = programIndex(shader);
+        uint64_t material = materialIndex(mesh, boundArrays);
+        keys.push_back(MakeKey(pass, program, material, mesh.VAO, depth));
+        draws.push_back({ &shader, &mesh, boundArrays, (int)objects.size() - 1 });
+    }
+
+    // draws everything queued since Begin, in key order
+    void Flush(const TransformFunction& setTransform)
+    {
+        sortKeys();
+        Shader* currentShader = nullptr;
+        int currentObject = -1;
+        for (const RenderSortEntry& entry : sorted)
+        {
+            const Draw& draw = draws[entry.draw];
+            if (draw.shader != currentShader)
+            {
+                draw.shader->use();
+                currentShader = draw.shader;
+                currentObject = -1;
+            }
+            if (draw.object != currentObject)
+            {
+                setTransform(*draw.shader, objects[draw.object]);
+                currentObject = draw.object;
+            }
+            static const std::vector<unsigned int> noArrays;
+            const std::vector<unsigned int>& arrays = draw.boundArrays != nullptr ? *draw.boundArrays : noArrays;
+            for (unsigned int i = 0; i < arrays.size(); i++)
+                GLState().BindTexture(i, GL_TEXTURE_2D_ARRAY, arrays[i]);
+            draw.mesh->Draw(*draw.shader, arrays);
+        }
+        draws.clear();
+        keys.clear();
+    }
+
+    size_t Size() const { return draws.size(); }
+
+    static constexpr uint64_t DEPTH_MAX = (1u << 20) - 1;
+    static constexpr size_t MAX_PROGRAMS = 1u << 10;
+    static constexpr size_t MAX_MATERIALS = 1u << 16;
+
+    // packs a draw into its sort key as laid out above. Every field is cut to its width, so an out of range value
+    // only makes draws share a key and never spills into the field above it.
+    static constexpr uint64_t MakeKey(RenderPass pass, uint64_t program, uint64_t material, uint64_t vertexArray, uint64_t depth)
+    {
+        program &= MAX_PROGRAMS - 1;
+        material &= MAX_MATERIALS - 1;
+        vertexArray &= 0xFFFF;
+        depth &= DEPTH_MAX;
+        uint64_t key = (uint64_t)(pass & 3) << 62;
+        if (pass == RENDER_PASS_OPAQUE)
+            return key | program << 52 | material << 36 | vertexArray << 20 | depth;
+        return key | (DEPTH_MAX - depth) << 42 | program << 32 | material << 16 | vertexArray;
+    }
+
+private:
+    struct Draw {
+        Shader* shader;
+        Mesh* mesh;
+        const std::vector<unsigned int>* boundArrays;
+        int object;     // index into objects
+    };
+
+    glm::mat4 view = glm::mat4(1.0f);
+    float farPlane = 100.0f;
+    std::vector<Draw> draws;
+    std::vector<uint64_t> keys;
+    std::vector<glm::mat4> objects;
+    std::vector<uint64_t> programs;                         // Shader::serial() of each program index
+    std::unordered_map<uint64_t, uint64_t> materials;       // texture set hash -> material index
+    std::vector<RenderSortEntry> sorted, scratch;           // kept between frames so sorting allocates nothing
+
+    // programs beyond the first MAX_PROGRAMS of a frame all share the last index
+    uint64_t programIndex(const Shader& shader)
+    {
+        auto found = std::find(programs.begin(), programs.end(), shader.serial());
+        if (found == programs.end())
+        {
+            programs.push_back(shader.serial());
+            found = programs.end() - 1;
+        }
+        return std::min<uint64_t>((uint64_t)(found - programs.begin()), MAX_PROGRAMS - 1);
+    }
+
+    // meshes binding the same textures (and the same arrays) share a material
+    uint64_t materialIndex(const Mesh& mesh, const std::vector<unsigned int>* boundArrays)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+        for (const Texture& texture : mesh.textures)
+        {
+            mix(texture.id);
+            mix((uint64_t)(int64_t)texture.layer);
+        }
+        if (boundArrays != nullptr)
+            for (unsigned int array : *boundArrays)
+                mix(array);
+        auto found = materials.try_emplace(hash, std::min<uint64_t>(materials.size(), MAX_MATERIALS - 1));
+        return found.first->second;
+    }
+
+    void sortKeys()
+    {
+        sorted.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+            sorted[i] = { keys[i], (uint32_t)i };
+        RadixSortKeys(sorted, scratch);
+    }
+};
+
+// Compile-time checks of the key layout and the sort. Each list gives MakeKey fields in queueing order; the checks
+// compare the order RadixSortKeys draws them in with the one the layout promises.
+namespace RenderQueueChecks
+{
+    struct Fields {
+        RenderPass pass;
+        uint64_t program, material, vertexArray, depth;
+    };
+
+    template <size_t N>
+    constexpr std::array<uint32_t, N> DrawOrder(const std::array<Fields, N>& queued)
+    {
+        std::vector<RenderSortEntry> entries, scratch;
+        for (size_t i = 0; i < N; i++)
+        {
+            const Fields& f = queued[i];
+            entries.push_back({ RenderQueue::MakeKey(f.pass, f.program, f.material, f.vertexArray, f.depth), (uint32_t)i });
+        }
+        RadixSortKeys(entries, scratch);
+        std::array<uint32_t, N> order{};
+        for (size_t i = 0; i < N; i++)
+            order[i] = entries[i].draw;
+        return order;
+    }
+
+    // opaque draws group by program, then material, then vertex array, and go front to back within a group;
+    // transparent ones come last, back to front whatever their state
+    constexpr std::array<Fields, 8> mixed{ {
+        { RENDER_PASS_TRANSPARENT, 0, 0, 0, 10 },
+        { RENDER_PASS_OPAQUE, 1, 0, 0, 5 },
+        { RENDER_PASS_OPAQUE, 0, 1, 0, 1 },
+        { RENDER_PASS_OPAQUE, 0, 0, 7, 9 },
+        { RENDER_PASS_TRANSPARENT, 1, 2, 3, 500 },
+        { RENDER_PASS_OPAQUE, 0, 0, 7, 2 },
+        { RENDER_PASS_OPAQUE, 0, 0, 3, 800 },
+        { RENDER_PASS_OPAQUE, 1, 0, 0, 4 },
+    } };
+    static_assert(DrawOrder(mixed) == std::array<uint32_t, 8>{ 6, 5, 3, 2, 7, 1, 4, 0 });
+
+    // draws with equal keys stay in queueing order
+    constexpr std::array<Fields, 4> ties{ {
+        { RENDER_PASS_OPAQUE, 2, 0, 0, 0 },
+        { RENDER_PASS_OPAQUE, 1, 0, 0, 0 },
+        { RENDER_PASS_OPAQUE, 2, 0, 0, 0 },
+        { RENDER_PASS_OPAQUE, 1, 0, 0, 0 },
+    } };
+    static_assert(DrawOrder(ties) == std::array<uint32_t, 4>{ 1, 3, 0, 2 });
+
+    // fields past their width wrap within their own bits instead of changing the pass or the fields above
+    static_assert(RenderQueue::MakeKey(RENDER_PASS_OPAQUE, RenderQueue::MAX_PROGRAMS + 1, 0, 0, 0) ==
+                  RenderQueue::MakeKey(RENDER_PASS_OPAQUE, 1, 0, 0, 0));
+    static_assert(RenderQueue::MakeKey(RENDER_PASS_OPAQUE, 0, 0, 0x10005, RenderQueue::DEPTH_MAX + 1) ==
+                  RenderQueue::MakeKey(RENDER_PASS_OPAQUE, 0, 0, 5, 0));
+    static_assert(RenderQueue::MakeKey(RENDER_PASS_OPAQUE, ~0ull, ~0ull, ~0ull, ~0ull) >> 62 == RENDER_PASS_OPAQUE);
+    static_assert(RenderQueue::MakeKey(RENDER_PASS_TRANSPARENT, ~0ull, ~0ull, ~0ull, ~0ull) >> 62 == RENDER_PASS_TRANSPARENT);
+
+    // a few hundred pseudo-random keys, spread over every digit, come out in order
+    constexpr bool SortsRandomKeys()
+    {
+        std::vector<RenderSortEntry> entries, scratch;
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        for (uint32_t i = 0; i < 300; i++)
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            entries.push_back({ state ^ (state >> 29), i });
+        }
+        RadixSortKeys(entries, scratch);
+        for (size_t i = 1; i < entries.size(); i++)
+            if (entries[i - 1].key > entries[i].key)
+                return false;
+        return entries.size() == 300;
+    }
+    static_assert(SortsRandomKeys());
+}
+#endif
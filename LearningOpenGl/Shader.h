@@ -6,11 +6,226 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "GLStateCache.h"
+#include "ProgramCache.h"
+#include "ShaderSources.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
 
+// A uniform name together with its FNV-1a hash, which is what Shader looks uniforms up by (the name itself is only
+// compared against the uniforms under that hash, so colliding names still find their own). Declared constexpr the
+// hash is computed at compile time, e.g.
+//     static constexpr UniformName projectionName("projection");
+// anything else (literals, std::string) converts implicitly and is hashed on the spot.
+struct UniformName
+{
+    std::string_view name;
+    uint32_t hash;
+
+    constexpr UniformName(std::string_view name) : name(name), hash(Hash(name)) {}
+    constexpr UniformName(const char* name) : UniformName(std::string_view(name)) {}
+    UniformName(const std::string& name) : UniformName(std::string_view(name)) {}
+
+    static constexpr uint32_t Hash(std::string_view name)
+    {
+        uint32_t hash = 2166136261u;
+        for (char c : name)
+            hash = (hash ^ (unsigned char)c) * 16777619u;
+        return hash;
+    }
+};
+// the reference FNV-1a values, and the names of the 32-bit collision the lookup has to tell apart
+static_assert(UniformName::Hash("") == 0x811c9dc5u && UniformName::Hash("a") == 0xe40c292cu && UniformName::Hash("foobar") == 0xbf9cf968u);
+static_assert(UniformName::Hash("u31992") == UniformName::Hash("u605430"));
+
+// whether a GLSL uniform type is an opaque sampler, which is set like an int (with its texture unit)
+inline bool IsSamplerType(GLenum type)
+{
+    switch (type)
+    {
+    case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT:
+    case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE: case GL_INT_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+    case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Maps a C++ value type to the GLSL uniform types it can be assigned to and the glUniform* call that does it. Kind
+// tells the C++ types apart in Shader's shadow copy.
+template <typename T> struct UniformType;
+template <> struct UniformType<bool> {
+    static constexpr GLenum Kind = GL_BOOL;
+    static bool Accepts(GLenum type) { return type == GL_BOOL; }
+    static void Upload(GLint location, const bool& value) { glUniform1i(location, (int)value); }
+};
+template <> struct UniformType<int> {
+    static constexpr GLenum Kind = GL_INT;
+    static bool Accepts(GLenum type) { return type == GL_INT || type == GL_BOOL || IsSamplerType(type); }
+    static void Upload(GLint location, const int& value) { glUniform1i(location, value); }
+};
+template <> struct UniformType<unsigned int> {
+    static constexpr GLenum Kind = GL_UNSIGNED_INT;
+    static bool Accepts(GLenum type) { return type == GL_UNSIGNED_INT || type == GL_BOOL; }
+    static void Upload(GLint location, const unsigned int& value) { glUniform1ui(location, value); }
+};
+template <> struct UniformType<float> {
+    static constexpr GLenum Kind = GL_FLOAT;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT; }
+    static void Upload(GLint location, const float& value) { glUniform1f(location, value); }
+};
+template <> struct UniformType<glm::vec2> {
+    static constexpr GLenum Kind = GL_FLOAT_VEC2;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+    static void Upload(GLint location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+};
+template <> struct UniformType<glm::vec3> {
+    static constexpr GLenum Kind = GL_FLOAT_VEC3;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void Upload(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+};
+template <> struct UniformType<glm::vec4> {
+    static constexpr GLenum Kind = GL_FLOAT_VEC4;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void Upload(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+};
+template <> struct UniformType<glm::mat2> {
+    static constexpr GLenum Kind = GL_FLOAT_MAT2;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT2; }
+    static void Upload(GLint location, const glm::mat2& value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template <> struct UniformType<glm::mat3> {
+    static constexpr GLenum Kind = GL_FLOAT_MAT3;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT3; }
+    static void Upload(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template <> struct UniformType<glm::mat4> {
+    static constexpr GLenum Kind = GL_FLOAT_MAT4;
+    static bool Accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void Upload(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+
+// A uniform of a program resolved to its location once, checked against its GLSL type. Get one from
+// Shader::uniform<T>(name) after linking and set it with Shader::set; an invalid handle (the uniform isn't active, or
+// has a different type) sets nothing.
+template <typename T>
+struct UniformHandle
+{
+    GLint location = -1;
+    int slot = -1;      // where Shader keeps the last value it uploaded
+
+    bool valid() const { return location >= 0; }
+};
+
+// Binding points of the uniform blocks every program shares (see UniformBlocks.h and LightingUniforms.h). GLSL 330 can't give a block a
+// binding itself, so Shader binds any of these it finds right after linking.
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint OBJECT_BLOCK_BINDING = 1;
+const GLuint LIGHTS_BLOCK_BINDING = 2;
+
+// per program count of uniform updates sent to GL and of those skipped because the value hadn't changed
+struct UniformUploadStats
+{
+    uint64_t issued = 0;
+    uint64_t skipped = 0;
+};
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// whether the driver compiles and links in the background and can be asked if it is done (KHR_parallel_shader_compile
+// or its ARB twin). Answered once per process from the extension list of the current context.
+inline bool ParallelShaderCompileSupported()
+{
+    static const bool supported = [] {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, (GLuint)i));
+            if (name != nullptr && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                                    std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                return true;
+        }
+        return false;
+    }();
+    return supported;
+}
+
+// #defines a program is built with, e.g. to select a variant of a shader (see ShaderVariants.h). Kept sorted by name,
+// so equal sets always produce the same text and therefore the same variant and program cache keys.
+struct ShaderDefines
+{
+    std::map<std::string, std::string> values;
+
+    ShaderDefines& Define(const std::string& name, const std::string& value = "1")
+    {
+        values[name] = value;
+        return *this;
+    }
+    ShaderDefines& Define(const std::string& name, int value)
+    {
+        return Define(name, std::to_string(value));
+    }
+
+    std::string Text() const
+    {
+        std::string text;
+        for (const auto& define : values)
+            text += "#define " + define.first + " " + define.second + "\n";
+        return text;
+    }
+
+    // adds the defines to a stage's source, right after its #version line (which has to stay the first directive),
+    // followed by a #line so the compiler's error messages still refer to the lines of the file
+    void InjectInto(std::string& code) const
+    {
+        if (values.empty())
+            return;
+        size_t position = 0;
+        size_t version = code.find("#version");
+        if (version != std::string::npos)
+        {
+            size_t end = code.find('\n', version);
+            position = end == std::string::npos ? code.size() : end + 1;
+        }
+        size_t nextLine = std::count(code.begin(), code.begin() + position, '\n') + 1;
+        std::string injected = Text() + "#line " + std::to_string(nextLine) + "\n";
+        if (position == code.size() && (code.empty() || code.back() != '\n'))
+            injected.insert(0, "\n");
+        code.insert(position, injected);
+    }
+};
+
+enum ShaderBuild {
+    SHADER_BUILD_NOW,       // compile and link before the constructor returns
+    SHADER_BUILD_DEFERRED   // only issue the compile and link; Shader::poll finishes them
+};
+
+enum ShaderState {
+    SHADER_PENDING,
+    SHADER_READY,
+    SHADER_FAILED
+};
+
+// Besides compiling and linking, Shader reflects the program's uniforms and keeps a copy of the value it last uploaded
+// to each, so setting a uniform to the value it already has costs a memcmp instead of a driver call.
 class Shader
 {
 public:
@@ -18,155 +233,411 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : Shader(vertexPath, fragmentPath, geometryPath, SHADER_BUILD_NOW)
+    {
+    }
+    // with SHADER_BUILD_DEFERRED the compile and link are only issued, so the driver can work on them (on its own threads
+    // where it supports KHR_parallel_shader_compile) while the caller goes on; poll() finishes the program later.
+    // defines are injected into every stage.
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, ShaderBuild build,
+           const ShaderDefines& defines = ShaderDefines())
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
+        // 1. retrieve the vertex/fragment source code from filePath, with their #includes resolved
+        // all stages are submitted as one batch so their reads overlap instead of running one file at a time
+        std::vector<std::string> paths = { vertexPath, fragmentPath };
+        if (geometryPath != nullptr)
+            paths.push_back(geometryPath);
+        stagePaths = paths;
+        buildDefines = defines;
+        std::vector<std::shared_ptr<const ExpandedSource>> sources = SharedShaderSources().Load(paths);
+        for (const auto& source : sources)
+            for (const std::string& file : source->files)
+                if (std::find(files.begin(), files.end(), file) == files.end())
+                    files.push_back(file);
+        std::string vertexCode = sources[0]->code;
+        std::string fragmentCode = sources[1]->code;
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
+        // if geometry shader path is present, also load a geometry shader
+        if (geometryPath != nullptr)
+            geometryCode = sources[2]->code;
+        defines.InjectInto(vertexCode);
+        defines.InjectInto(fragmentCode);
+        if (geometryPath != nullptr)
+            defines.InjectInto(geometryCode);
+        // 2. reuse the binary of an earlier run if neither the sources nor the driver have changed since
+        ID = glCreateProgram();
+        cacheable = ProgramCache::Supported();
+        if (cacheable)
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-            // if geometry shader path is present, also load a geometry shader
-            if (geometryPath != nullptr)
+            std::vector<uint64_t> stageHashes;
+            for (const auto& source : sources)
+                stageHashes.push_back(source->hash);
+            cacheKey = ProgramCache::Key(stageHashes, defines.Text());
+            if (SharedProgramCache().Load(cacheKey, ID))
             {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                buildState = SHADER_READY;
+                prepareLinkedProgram();
+                return;
             }
         }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        // 3. issue the compiles and the link; nothing below waits for the driver
+        compileStage(GL_VERTEX_SHADER, vertexCode, sources[0]);
+        compileStage(GL_FRAGMENT_SHADER, fragmentCode, sources[1]);
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
         if (geometryPath != nullptr)
+            compileStage(GL_GEOMETRY_SHADER, geometryCode, sources[2]);
+        if (cacheable)
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        if (build == SHADER_BUILD_NOW)
+            finishBuild();
+    }
+    // every source file the program was built from, including the ones pulled in through #include
+    // ------------------------------------------------------------------------
+    const std::vector<std::string>& sourceFiles() const
+    {
+        return files;
+    }
+    // a new program built from the same files with the same defines, e.g. after one of them changed on disk. This one
+    // is left as it is.
+    // ------------------------------------------------------------------------
+    std::shared_ptr<Shader> rebuild(ShaderBuild build) const
+    {
+        const char* geometryPath = stagePaths.size() > 2 ? stagePaths[2].c_str() : nullptr;
+        return std::make_shared<Shader>(stagePaths[0].c_str(), stagePaths[1].c_str(), geometryPath, build, buildDefines);
+    }
+    // tells builds apart: GL hands a deleted program's ID out again, but no two builds share a serial. Caches keyed by
+    // it (see Mesh) notice when a hot reload swaps a new program into this Shader.
+    // ------------------------------------------------------------------------
+    uint64_t serial() const
+    {
+        return buildSerial;
+    }
+    // SHADER_PENDING until a deferred build has been finished by poll(), then whether it worked
+    // ------------------------------------------------------------------------
+    ShaderState state() const
+    {
+        return buildState;
+    }
+    // finishes a deferred build once the driver is done with it and returns whether the program is no longer pending.
+    // Without KHR_parallel_shader_compile there is no way to ask, so poll() only finishes the build when allowed to wait.
+    // ------------------------------------------------------------------------
+    bool poll(bool wait = false)
+    {
+        if (buildState != SHADER_PENDING)
+            return true;
+        if (!wait)
         {
-            const char* gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            if (!ParallelShaderCompileSupported())
+                return false;
+            GLint complete = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+            if (complete != GL_TRUE)
+                return false;
         }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        finishBuild();
+        return true;
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use()
     {
-        glUseProgram(ID);
+        GLState().UseProgram(ID);
+    }
+    // location of an active uniform, or -1 (which glUniform* ignores) if the program has none by that name
+    // ------------------------------------------------------------------------
+    GLint location(UniformName name) const
+    {
+        const ActiveUniform* uniform = find(name);
+        return uniform != nullptr ? uniform->location : -1;
+    }
+    // resolves a uniform to a typed handle. Resolve once, e.g. right after construction, and keep the handle: setting
+    // through it involves no name at all.
+    // ------------------------------------------------------------------------
+    template <typename T>
+    UniformHandle<T> uniform(UniformName name) const
+    {
+        const ActiveUniform* uniform = find(name);
+        if (uniform == nullptr)
+            return {};
+        if (!UniformType<T>::Accepts(uniform->type))
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << name.name << " has GLSL type 0x" << std::hex
+                      << uniform->type << std::dec << std::endl;
+            return {};
+        }
+        return { uniform->location, uniform->slot };
+    }
+    // ------------------------------------------------------------------------
+    template <typename T>
+    void set(UniformHandle<T> uniform, const T& value) const
+    {
+        if (uniform.valid())
+            upload(uniform.location, uniform.slot, value);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(UniformName name, bool value) const
+    {
+        setByName(name, value);
+    }
+    // ------------------------------------------------------------------------
+    void setInt(UniformName name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        setByName(name, value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setFloat(UniformName name, float value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setByName(name, value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void setVec2(UniformName name, const glm::vec2& value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        setByName(name, value);
+    }
+    void setVec2(UniformName name, float x, float y) const
+    {
+        setByName(name, glm::vec2(x, y));
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec3(UniformName name, const glm::vec3& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setByName(name, value);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec3(UniformName name, float x, float y, float z) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        setByName(name, glm::vec3(x, y, z));
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec4(UniformName name, const glm::vec4& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setByName(name, value);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec4(UniformName name, float x, float y, float z, float w)
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        setByName(name, glm::vec4(x, y, z, w));
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setMat2(UniformName name, const glm::mat2& mat) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setByName(name, mat);
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w)
+    // ------------------------------------------------------------------------
+    void setMat3(UniformName name, const glm::mat3& mat) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        setByName(name, mat);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat4(UniformName name, const glm::mat4& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setByName(name, mat);
     }
+    // connects the program's uniform block name (if it has one) to a buffer binding point
     // ------------------------------------------------------------------------
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void bindUniformBlock(const char* name, GLuint binding)
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLuint index = glGetUniformBlockIndex(ID, name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
     }
+    // how many uniform updates reached GL and how many were dropped because the program already had that value
     // ------------------------------------------------------------------------
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    UniformUploadStats uploadStats() const
+    {
+        return stats;
+    }
+    void resetUploadStats()
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        stats = {};
+    }
+    // forgets the values the program is known to hold; call after changing its uniforms behind Shader's back
+    // ------------------------------------------------------------------------
+    void invalidateUniformShadow()
+    {
+        std::fill(shadowKind.begin(), shadowKind.end(), (GLenum)0);
     }
 
 private:
+    struct ActiveUniform {
+        std::string name;
+        GLint location;
+        GLenum type;
+        int slot;       // the value's place in the shadow copy
+    };
+    // active uniforms by name hash, filled in once after linking. A 32-bit hash can collide, hence a multimap.
+    std::unordered_multimap<uint32_t, ActiveUniform> uniforms;
+    // CPU copy of the value last uploaded to each uniform: SHADOW_SLOT_SIZE bytes per slot, plus the UniformType Kind
+    // it was written as (0 while it hasn't been set yet)
+    static const size_t SHADOW_SLOT_SIZE = 64;
+    mutable std::vector<unsigned char> shadow;
+    mutable std::vector<GLenum> shadowKind;
+    mutable UniformUploadStats stats;
+
+    ShaderState buildState = SHADER_PENDING;
+    uint64_t buildSerial = nextSerial();
+    bool cacheable = false;
+    uint64_t cacheKey = 0;
+    std::vector<std::string> files;  // every source file the program was built from, includes too
+    std::vector<std::string> stagePaths;    // vertex, fragment and (optionally) geometry file, as given
+    ShaderDefines buildDefines;
+    struct Stage {
+        unsigned int shader;
+        const char* name;
+        std::shared_ptr<const ExpandedSource> source;
+    };
+    std::vector<Stage> stages;   // compiled but not yet checked
+
+    void compileStage(GLenum type, const std::string& code, std::shared_ptr<const ExpandedSource> source)
+    {
+        const char* text = code.c_str();
+        unsigned int stage = glCreateShader(type);
+        glShaderSource(stage, 1, &text, NULL);
+        glCompileShader(stage);
+        glAttachShader(ID, stage);
+        const char* name = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "GEOMETRY";
+        stages.push_back({ stage, name, std::move(source) });
+    }
+
+    // checks the results of the compiles and the link, which waits for the driver if it isn't done yet
+    // ------------------------------------------------------------------------
+    void finishBuild()
+    {
+        bool compiled = true;
+        for (const Stage& stage : stages)
+        {
+            if (checkCompileErrors(stage.shader, stage.name))
+                continue;
+            compiled = false;
+            // the messages number the files the stage was assembled from
+            for (size_t i = 0; i < stage.source->files.size(); i++)
+                std::cout << "  " << i << ": " << stage.source->files[i] << std::endl;
+        }
+        bool linked = checkCompileErrors(ID, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessary
+        for (const Stage& stage : stages)
+            glDeleteShader(stage.shader);
+        stages.clear();
+        buildState = compiled && linked ? SHADER_READY : SHADER_FAILED;
+        if (buildState != SHADER_READY)
+            return;
+        if (cacheable)
+            SharedProgramCache().Store(cacheKey, ID);
+        prepareLinkedProgram();
+    }
+
+    // everything that follows a successful link, whether from source or from a cached binary
+    // ------------------------------------------------------------------------
+    void prepareLinkedProgram()
+    {
+        reflectUniforms();
+        bindUniformBlock("Frame", FRAME_BLOCK_BINDING);
+        bindUniformBlock("Object", OBJECT_BLOCK_BINDING);
+        bindUniformBlock("Lights", LIGHTS_BLOCK_BINDING);
+    }
+
+    static uint64_t nextSerial()
+    {
+        static std::atomic<uint64_t> counter{ 0 };
+        return ++counter;
+    }
+
+    // the uniform called name; a name that isn't active but shares the hash of one that is finds nothing
+    const ActiveUniform* find(UniformName name) const
+    {
+        auto candidates = uniforms.equal_range(name.hash);
+        for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+            if (candidate->second.name == name.name)
+                return &candidate->second;
+        return nullptr;
+    }
+
+    template <typename T>
+    void setByName(UniformName name, const T& value) const
+    {
+        const ActiveUniform* uniform = find(name);
+        if (uniform == nullptr)
+            return;
+        if (!UniformType<T>::Accepts(uniform->type))
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << name.name << " has GLSL type 0x" << std::hex
+                      << uniform->type << std::dec << std::endl;
+            return;
+        }
+        upload(uniform->location, uniform->slot, value);
+    }
+
+    // issues the glUniform* call unless the program already holds exactly this value. A value last written as another
+    // C++ type (setBool, then setInt) never counts as the same, and the slot is cleared before a value goes in, so no
+    // bytes of a larger earlier value are left behind.
+    template <typename T>
+    void upload(GLint location, int slot, const T& value) const
+    {
+        static_assert(sizeof(T) <= SHADOW_SLOT_SIZE, "uniform value larger than a shadow slot");
+        unsigned char* last = &shadow[(size_t)slot * SHADOW_SLOT_SIZE];
+        if (shadowKind[slot] == UniformType<T>::Kind && std::memcmp(last, &value, sizeof(T)) == 0)
+        {
+            stats.skipped++;
+            return;
+        }
+        std::memset(last, 0, SHADOW_SLOT_SIZE);
+        std::memcpy(last, &value, sizeof(T));
+        shadowKind[slot] = UniformType<T>::Kind;
+        stats.issued++;
+        UniformType<T>::Upload(location, value);
+    }
+
+    // asks the linked program for all of its active uniforms so the setters never have to query GL by name
+    // ------------------------------------------------------------------------
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint base = glGetUniformLocation(ID, name.c_str());
+            // members of uniform blocks have no location
+            if (base < 0)
+                continue;
+            int slot = addUniform(name, base, type, -1);
+            // arrays are reported as "name[0]": make "name" and every element reachable too
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string array = name.substr(0, name.size() - 3);
+                addUniform(array, base, type, slot);
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = array + "[" + std::to_string(element) + "]";
+                    addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()), type, -1);
+                }
+            }
+        }
+    }
+    // registers a uniform under name, giving it a new shadow slot unless it aliases an existing one; returns the slot
+    int addUniform(const std::string& name, GLint location, GLenum type, int slot)
+    {
+        if (slot < 0)
+        {
+            slot = (int)shadowKind.size();
+            shadowKind.push_back(0);
+            shadow.resize(shadowKind.size() * SHADOW_SLOT_SIZE);
+        }
+        if (find(name) == nullptr)
+            uniforms.insert({ UniformName::Hash(name), { name, location, type, slot } });
+        return slot;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -188,6 +659,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success == GL_TRUE;
     }
 };
 #endif
@@ -0,0 +1,87 @@
+#ifndef SHADER_COMPILE_QUEUE_H
+#define SHADER_COMPILE_QUEUE_H
+
+#include "Shader.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Builds programs without stalling the frame. Add() reads the sources and issues the compile and link right away, so
+// everything added up front is in the driver's hands at once, and Poll() (once per frame) finishes whatever the
+// driver reports done and runs its onReady callback. Where KHR_parallel_shader_compile is missing there is no way to
+// ask, so Poll() then finishes one program per call, waiting for it, to spread the cost over several frames.
+//
+// Until a program is ready, draw with something else: UsableShader picks the fallback meanwhile.
+class ShaderCompileQueue
+{
+public:
+    // issues the build and returns the program, which stays SHADER_PENDING until a Poll() finishes it. onReady runs
+    // once it has linked, e.g. to resolve uniform handles.
+    std::shared_ptr<Shader> Add(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+                                std::function<void(Shader&)> onReady = {}, const ShaderDefines& defines = ShaderDefines())
+    {
+        return Add(std::make_shared<Shader>(vertexPath, fragmentPath, geometryPath, SHADER_BUILD_DEFERRED, defines), std::move(onReady));
+    }
+    // takes over a program constructed with SHADER_BUILD_DEFERRED, e.g. from Shader::rebuild
+    std::shared_ptr<Shader> Add(std::shared_ptr<Shader> shader, std::function<void(Shader&)> onReady = {})
+    {
+        pending.push_back({ shader, std::move(onReady) });
+        return shader;
+    }
+
+    // finishes the programs the driver is done with, in any order
+    void Poll()
+    {
+        bool waited = false;
+        for (size_t i = 0; i < pending.size();)
+        {
+            Pending& entry = pending[i];
+            bool finished = entry.shader->poll();
+            if (!finished && !waited && !ParallelShaderCompileSupported())
+            {
+                finished = entry.shader->poll(true);
+                waited = true;
+            }
+            if (!finished)
+            {
+                i++;
+                continue;
+            }
+            Pending done = std::move(entry);
+            pending.erase(pending.begin() + i);
+            if (done.shader->state() == SHADER_READY && done.onReady)
+                done.onReady(*done.shader);
+        }
+    }
+
+    // finishes everything still pending right away, e.g. behind a loading screen
+    void Flush()
+    {
+        while (!pending.empty())
+        {
+            Pending done = std::move(pending.front());
+            pending.erase(pending.begin());
+            done.shader->poll(true);
+            if (done.shader->state() == SHADER_READY && done.onReady)
+                done.onReady(*done.shader);
+        }
+    }
+
+    bool IsIdle() const { return pending.empty(); }
+
+private:
+    struct Pending {
+        std::shared_ptr<Shader> shader;
+        std::function<void(Shader&)> onReady;
+    };
+
+    std::vector<Pending> pending;
+};
+
+// the shader to draw with: wanted once it has linked, fallback while it is still building (or failed to build)
+inline Shader& UsableShader(const std::shared_ptr<Shader>& wanted, Shader& fallback)
+{
+    return wanted && wanted->state() == SHADER_READY ? *wanted : fallback;
+}
+#endif
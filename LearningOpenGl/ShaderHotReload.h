@@ -0,0 +1,250 @@
+#ifndef SHADER_HOT_RELOAD_H
+#define SHADER_HOT_RELOAD_H
+
+#include "ShaderCompileQueue.h"
+#include "ShaderSources.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+// Tells which of the files it was asked to watch have changed on disk since the last TakeChanged(). A thread of its
+// own does the watching: on Linux it blocks on inotify, with a watch on the directory of each file rather than the
+// file itself, since editors often save by writing a new file and renaming it over the old one, which drops a watch
+// on the file. Elsewhere it compares modification times four times a second.
+class FileWatcher
+{
+public:
+    FileWatcher()
+    {
+#if defined(__linux__)
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            std::cout << "ERROR::FILE_WATCHER::INOTIFY_INIT_FAILED" << std::endl;
+#endif
+        thread = std::thread([this] { watchLoop(); });
+    }
+    ~FileWatcher()
+    {
+        stopping = true;
+        thread.join();
+#if defined(__linux__)
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    void Watch(const std::string& path)
+    {
+        std::string file = ShaderSourceCache::normalise(path);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!watched.insert(file).second)
+            return;
+#if defined(__linux__)
+        std::string directory = std::filesystem::path(file).parent_path().generic_string();
+        if (fd < 0 || watchedDirectories.count(directory))
+            return;
+        int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0)
+        {
+            std::cout << "ERROR::FILE_WATCHER::CANNOT_WATCH: " << directory << std::endl;
+            return;
+        }
+        directories[wd] = directory;
+        watchedDirectories.insert(directory);
+#else
+        modified[file] = lastWriteTime(file);
+#endif
+    }
+
+    // the watched files that changed since the last call, each once
+    std::vector<std::string> TakeChanged()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result(changed.begin(), changed.end());
+        changed.clear();
+        return result;
+    }
+
+private:
+    std::thread thread;
+    std::atomic<bool> stopping{ false };
+    std::mutex mutex;
+    std::set<std::string> watched;
+    std::set<std::string> changed;
+#if defined(__linux__)
+    int fd = -1;
+    std::map<int, std::string> directories;     // inotify watch descriptor -> directory
+    std::set<std::string> watchedDirectories;
+#else
+    std::map<std::string, std::filesystem::file_time_type> modified;
+#endif
+
+#if defined(__linux__)
+    void watchLoop()
+    {
+        // woken every 100ms to see whether the destructor is waiting
+        alignas(inotify_event) char buffer[4096];
+        while (!stopping)
+        {
+            pollfd request{ fd, POLLIN, 0 };
+            if (fd < 0 || poll(&request, 1, 100) <= 0)
+            {
+                if (fd < 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (char* at = buffer; at < buffer + length;)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(at);
+                    at += sizeof(inotify_event) + event->len;
+                    auto directory = directories.find(event->wd);
+                    if (event->len == 0 || directory == directories.end())
+                        continue;
+                    std::string file = ShaderSourceCache::normalise((std::filesystem::path(directory->second) / event->name).generic_string());
+                    // other files in the same directory (an editor's swap files, say) are of no interest
+                    if (watched.count(file))
+                        changed.insert(file);
+                }
+            }
+        }
+    }
+#else
+    void watchLoop()
+    {
+        while (!stopping)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& file : modified)
+            {
+                std::filesystem::file_time_type time = lastWriteTime(file.first);
+                if (time != file.second)
+                {
+                    file.second = time;
+                    changed.insert(file.first);
+                }
+            }
+        }
+    }
+
+    static std::filesystem::file_time_type lastWriteTime(const std::string& file)
+    {
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(file, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
+#endif
+};
+
+// Rebuilds programs whose sources (includes too) change on disk while the application runs. Update(), called once per
+// frame before drawing, looks at what the FileWatcher saw, drops those files from the shared source cache and issues a
+// deferred rebuild on the compile queue of each watched program that used one of them; nothing else is recompiled.
+// Once a rebuild has linked, the next Update() moves it into the watched Shader object, so everything holding that
+// Shader draws with the new program from that frame on and never sees a half-built one. A rebuild that fails to
+// compile or link is thrown away and the last good program stays in use.
+//
+// Uniform handles resolved against the old program are stale after a swap; resolve them again in onReloaded.
+class ShaderHotReload
+{
+public:
+    explicit ShaderHotReload(ShaderCompileQueue& queue) : queue(queue)
+    {
+    }
+
+    // watches every file shader was built from. onReloaded runs after a new program has been swapped in.
+    void Watch(std::shared_ptr<Shader> shader, std::function<void(Shader&)> onReloaded = {})
+    {
+        for (const std::string& file : shader->sourceFiles())
+            watcher.Watch(file);
+        programs.push_back({ std::move(shader), std::move(onReloaded) });
+    }
+
+    // call once per frame, between frames, with the queue's Poll() before or after it
+    void Update()
+    {
+        std::vector<std::string> changed = watcher.TakeChanged();
+        for (const std::string& file : changed)
+        {
+            SharedShaderSources().Invalidate(file);
+            std::cout << "shader source changed: " << file << std::endl;
+        }
+        for (Program& program : programs)
+        {
+            if (!program.dirty && usesAny(*program.live, changed))
+                program.dirty = true;
+            if (program.rebuilding && program.rebuilding->state() != SHADER_PENDING)
+                finishRebuild(program);
+            // one rebuild at a time per program: a file saved again meanwhile is picked up once it is done. A program
+            // still on its first build is left to finish that first.
+            if (program.dirty && !program.rebuilding && program.live->state() != SHADER_PENDING)
+            {
+                program.dirty = false;
+                program.rebuilding = queue.Add(program.live->rebuild(SHADER_BUILD_DEFERRED));
+            }
+        }
+    }
+
+private:
+    struct Program {
+        std::shared_ptr<Shader> live;
+        std::function<void(Shader&)> onReloaded;
+        std::shared_ptr<Shader> rebuilding;
+        bool dirty = false;
+    };
+
+    ShaderCompileQueue& queue;
+    FileWatcher watcher;
+    std::vector<Program> programs;
+
+    static bool usesAny(const Shader& shader, const std::vector<std::string>& changed)
+    {
+        for (const std::string& file : changed)
+            if (std::find(shader.sourceFiles().begin(), shader.sourceFiles().end(), file) != shader.sourceFiles().end())
+                return true;
+        return false;
+    }
+
+    void finishRebuild(Program& program)
+    {
+        std::shared_ptr<Shader> rebuilt = std::move(program.rebuilding);
+        if (rebuilt->state() != SHADER_READY)
+        {
+            std::cout << "shader reload failed, keeping the previous program" << std::endl;
+            GLState().DeleteProgram(rebuilt->ID);
+            return;
+        }
+        // afterwards rebuilt holds the old program, which GL frees once nothing uses it any more
+        std::swap(*program.live, *rebuilt);
+        GLState().DeleteProgram(rebuilt->ID);
+        // the new version may include files the old one didn't
+        for (const std::string& file : program.live->sourceFiles())
+            watcher.Watch(file);
+        if (program.onReloaded)
+            program.onReloaded(*program.live);
+    }
+};
+#endif
@@ -0,0 +1,211 @@
+#ifndef SHADER_SOURCES_H
+#define SHADER_SOURCES_H
+
+#include "AssetIO.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// a shader stage's source with every #include resolved
+struct ExpandedSource {
+    std::string code;
+    // every file the code was assembled from, the stage's own file first. The position of a file in this list is its
+    // source string number, which is what compiler messages like "1:12(3)" start with.
+    std::vector<std::string> files;
+    // hash of the paths and contents of all those files, in order. code is made from nothing else, so two stages with
+    // equal hashes expand to the same code; ProgramCache keys programs on it instead of hashing the code again.
+    uint64_t hash = 0;
+    bool ok = true;
+};
+
+// An #include preprocessor for GLSL with an in-memory cache of the files it has read. A line of the form
+//
+//     #include "lighting.glsl"
+//
+// is replaced by that file's contents (the path is relative to the including file). Every file is pasted in at most
+// once per stage, so shared files need no include guards and cycles are harmless, and #line directives keep compiler
+// messages pointing at the right file and line. Both the raw files and the expanded stages are cached, and the cache
+// remembers which stages each file went into, so when a file changes Invalidate() tells exactly which stages (and
+// therefore which programs) have to be rebuilt.
+//
+// Not thread-safe: use it from the thread that builds programs.
+class ShaderSourceCache
+{
+public:
+    // the expanded sources of paths, reading every file that isn't cached yet in one batch
+    std::vector<std::shared_ptr<const ExpandedSource>> Load(const std::vector<std::string>& paths)
+    {
+        std::vector<std::string> missing;
+        for (const std::string& path : paths)
+            if (expanded.find(normalise(path)) == expanded.end() && files.find(normalise(path)) == files.end())
+                missing.push_back(normalise(path));
+        readFiles(missing);
+
+        std::vector<std::shared_ptr<const ExpandedSource>> results;
+        for (const std::string& path : paths)
+            results.push_back(Load(path));
+        return results;
+    }
+
+    std::shared_ptr<const ExpandedSource> Load(const std::string& path)
+    {
+        std::string root = normalise(path);
+        auto found = expanded.find(root);
+        if (found != expanded.end())
+            return found->second;
+
+        auto source = std::make_shared<ExpandedSource>();
+        uint64_t hash = 14695981039346656037ull;
+        expand(root, *source, hash);
+        source->hash = hash;
+        for (const std::string& file : source->files)
+            dependents[file].push_back(root);
+        expanded[root] = source;
+        return source;
+    }
+
+    // forgets the cached contents of a file that changed on disk and every expanded stage that used it. Returns those
+    // stages' paths, so the programs built from them can be rebuilt.
+    std::vector<std::string> Invalidate(const std::string& path)
+    {
+        std::string file = normalise(path);
+        files.erase(file);
+        std::vector<std::string> stages;
+        auto found = dependents.find(file);
+        if (found == dependents.end())
+            return stages;
+        stages = found->second;
+        for (const std::string& stage : stages)
+        {
+            auto source = expanded.find(stage);
+            if (source == expanded.end())
+                continue;
+            // the stage no longer depends on anything until it is expanded again
+            for (const std::string& used : source->second->files)
+            {
+                std::vector<std::string>& users = dependents[used];
+                users.erase(std::remove(users.begin(), users.end(), stage), users.end());
+            }
+            expanded.erase(source);
+        }
+        return stages;
+    }
+
+    // the form paths are compared in, so "shaders/../colors.fs" and "colors.fs" are the same file
+    static std::string normalise(const std::string& path)
+    {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+private:
+    struct File {
+        std::string text;
+        bool ok = false;
+    };
+
+    std::unordered_map<std::string, File> files;
+    std::unordered_map<std::string, std::shared_ptr<ExpandedSource>> expanded;
+    std::unordered_map<std::string, std::vector<std::string>> dependents;   // file -> stages that include it
+
+    void readFiles(const std::vector<std::string>& paths)
+    {
+        if (paths.empty())
+            return;
+        std::vector<AssetReadResult> results = SharedAssetReader().ReadAll(paths, ASSET_IO_HIGH);
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            File& file = files[paths[i]];
+            file.ok = results[i].ok;
+            file.text.assign(results[i].data.begin(), results[i].data.end());
+            if (!file.ok)
+                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << paths[i] << std::endl;
+        }
+    }
+
+    const File& file(const std::string& path)
+    {
+        auto found = files.find(path);
+        if (found == files.end())
+        {
+            readFiles({ path });
+            found = files.find(path);
+        }
+        return found->second;
+    }
+
+    // appends path (and, recursively, what it includes) to source.code
+    void expand(const std::string& path, ExpandedSource& source, uint64_t& hash)
+    {
+        const File& contents = file(path);
+        int number = (int)source.files.size();
+        source.files.push_back(path);
+        source.ok &= contents.ok;
+        // the lengths keep "ab" + "c" apart from "a" + "bc"
+        uint64_t length = path.size();
+        hash = HashBytes(&length, sizeof(length), hash);
+        hash = HashBytes(path.data(), path.size(), hash);
+        length = contents.text.size();
+        hash = HashBytes(&length, sizeof(length), hash);
+        hash = HashBytes(contents.text.data(), contents.text.size(), hash);
+
+        const std::string& text = contents.text;
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        size_t lineStart = 0;
+        int line = 1;
+        while (lineStart < text.size())
+        {
+            size_t lineEnd = text.find('\n', lineStart);
+            if (lineEnd == std::string::npos)
+                lineEnd = text.size();
+            std::string include;
+            if (parseInclude(text, lineStart, lineEnd, include))
+            {
+                std::string included = normalise((directory / include).generic_string());
+                if (std::find(source.files.begin(), source.files.end(), included) == source.files.end())
+                {
+                    source.code += "#line 1 " + std::to_string(source.files.size()) + "\n";
+                    expand(included, source, hash);
+                    if (source.code.empty() || source.code.back() != '\n')
+                        source.code += '\n';
+                }
+                // carry on with the line after the #include, in this file
+                source.code += "#line " + std::to_string(line + 1) + " " + std::to_string(number) + "\n";
+            }
+            else
+                source.code.append(text, lineStart, lineEnd - lineStart).append("\n");
+            lineStart = lineEnd + 1;
+            line++;
+        }
+    }
+
+    // whether text[begin, end) is an #include "name" line, and the name if so
+    static bool parseInclude(const std::string& text, size_t begin, size_t end, std::string& name)
+    {
+        size_t at = text.find_first_not_of(" \t", begin);
+        if (at >= end || text.compare(at, 8, "#include") != 0)
+            return false;
+        size_t open = text.find('"', at + 8);
+        if (open >= end)
+            return false;
+        size_t close = text.find('"', open + 1);
+        if (close >= end)
+            return false;
+        name = text.substr(open + 1, close - open - 1);
+        return true;
+    }
+};
+
+// the source cache every Shader reads through
+inline ShaderSourceCache& SharedShaderSources()
+{
+    static ShaderSourceCache cache;
+    return cache;
+}
+#endif
@@ -0,0 +1,62 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "Shader.h"
+#include "ShaderCompileQueue.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// The specialised programs built from one set of shader files, one per set of #defines. Instead of a single uber-shader
+// that checks at run time which lights and maps a draw has, each draw asks for the variant that matches it:
+//
+//     ShaderDefines defines;
+//     defines.Define("POINT_LIGHT_COUNT", 2).Define("NO_SPOTLIGHT");
+//     Shader& shader = UsableShader(litVariants.Get(defines), fallbackShader);
+//
+// A variant is built the first time it is asked for and kept from then on. With a ShaderCompileQueue the build runs in
+// the background and Get returns a pending program until the queue finishes it; without one it is built on the spot.
+class ShaderVariants
+{
+public:
+    ShaderVariants(std::string vertexPath, std::string fragmentPath, std::string geometryPath = "",
+                   ShaderCompileQueue* queue = nullptr)
+        : vertexPath(std::move(vertexPath)), fragmentPath(std::move(fragmentPath)), geometryPath(std::move(geometryPath)),
+          queue(queue)
+    {
+    }
+
+    std::shared_ptr<Shader> Get(const ShaderDefines& defines)
+    {
+        std::string key = defines.Text();
+        auto found = variants.find(key);
+        if (found != variants.end())
+            return found->second;
+        const char* geometry = geometryPath.empty() ? nullptr : geometryPath.c_str();
+        std::shared_ptr<Shader> shader;
+        if (queue != nullptr)
+            shader = queue->Add(vertexPath.c_str(), fragmentPath.c_str(), geometry, {}, defines);
+        else
+            shader = std::make_shared<Shader>(vertexPath.c_str(), fragmentPath.c_str(), geometry, SHADER_BUILD_NOW, defines);
+        variants.insert({ key, shader });
+        return shader;
+    }
+
+    // builds variants ahead of their first draw, e.g. every combination a level uses while it loads
+    void Prepare(const ShaderDefines& defines)
+    {
+        Get(defines);
+    }
+
+    size_t Count() const { return variants.size(); }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;
+    ShaderCompileQueue* queue;
+    // keyed by the define text, which ShaderDefines keeps in a canonical order
+    std::unordered_map<std::string, std::shared_ptr<Shader>> variants;
+};
+#endif
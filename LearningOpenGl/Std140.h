@@ -0,0 +1,341 @@
+#ifndef STD140_H
+#define STD140_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLStateCache.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// std140 layouts for C++ structs, worked out at compile time. Describe a struct's fields once:
+//
+//     template <> struct Std140Layout<PointLight> {
+//         static constexpr auto fields = std::make_tuple(STD140_MEMBER(PointLight, position), ...);
+//     };
+//
+// in the order the GLSL block or struct declares them, and Std140Size, Std140Offsets and Std140Pack give its size,
+// member offsets and a packed copy including all the padding GLSL expects. Fields can be scalars, glm vectors and
+// matrices, other described structs, and arrays of any of these. ValidateStd140Block checks a description against
+// the offsets the linker reports for a program's block, so a C++ struct drifting away from its GLSL twin shows up at
+// startup instead of as garbage on screen.
+
+template <typename T> struct Std140Layout;
+
+template <typename Class, typename Member>
+struct Std140Member {
+    typedef Member Type;
+    const char* name;
+    Member Class::* member;
+};
+#define STD140_MEMBER(Struct, field) Std140Member<Struct, decltype(Struct::field)>{ #field, &Struct::field }
+
+// alignment, size and how to write the leaf types
+template <typename T> struct Std140Leaf;
+template <> struct Std140Leaf<float> {
+    static constexpr size_t alignment = 4, size = 4;
+    static void Write(unsigned char* dst, const float& value) { std::memcpy(dst, &value, 4); }
+};
+template <> struct Std140Leaf<int> {
+    static constexpr size_t alignment = 4, size = 4;
+    static void Write(unsigned char* dst, const int& value) { std::memcpy(dst, &value, 4); }
+};
+template <> struct Std140Leaf<unsigned int> {
+    static constexpr size_t alignment = 4, size = 4;
+    static void Write(unsigned char* dst, const unsigned int& value) { std::memcpy(dst, &value, 4); }
+};
+template <> struct Std140Leaf<bool> {
+    static constexpr size_t alignment = 4, size = 4;
+    static void Write(unsigned char* dst, const bool& value) { uint32_t v = value; std::memcpy(dst, &v, 4); }
+};
+template <> struct Std140Leaf<glm::vec2> {
+    static constexpr size_t alignment = 8, size = 8;
+    static void Write(unsigned char* dst, const glm::vec2& value) { std::memcpy(dst, &value[0], 8); }
+};
+template <> struct Std140Leaf<glm::vec3> {
+    static constexpr size_t alignment = 16, size = 12;
+    static void Write(unsigned char* dst, const glm::vec3& value) { std::memcpy(dst, &value[0], 12); }
+};
+template <> struct Std140Leaf<glm::vec4> {
+    static constexpr size_t alignment = 16, size = 16;
+    static void Write(unsigned char* dst, const glm::vec4& value) { std::memcpy(dst, &value[0], 16); }
+};
+// matrices are arrays of column vectors, each padded to a vec4
+template <> struct Std140Leaf<glm::mat3> {
+    static constexpr size_t alignment = 16, size = 48;
+    static void Write(unsigned char* dst, const glm::mat3& value)
+    {
+        for (int column = 0; column < 3; column++)
+            std::memcpy(dst + 16 * column, &value[column][0], 12);
+    }
+};
+template <> struct Std140Leaf<glm::mat4> {
+    static constexpr size_t alignment = 16, size = 64;
+    static void Write(unsigned char* dst, const glm::mat4& value) { std::memcpy(dst, &value[0][0], 64); }
+};
+
+constexpr size_t Std140RoundUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+concept Std140Struct = requires { Std140Layout<T>::fields; };
+
+template <typename T> struct Std140Info;
+
+// offsets of a described struct's fields, relative to the start of the struct
+template <Std140Struct T>
+constexpr auto Std140Offsets()
+{
+    constexpr size_t count = std::tuple_size_v<std::remove_const_t<decltype(Std140Layout<T>::fields)>>;
+    std::array<size_t, count> offsets{};
+    size_t offset = 0, i = 0;
+    std::apply([&](const auto&... field) {
+        ((offset = Std140RoundUp(offset, Std140Info<typename std::remove_cvref_t<decltype(field)>::Type>::alignment),
+          offsets[i++] = offset,
+          offset += Std140Info<typename std::remove_cvref_t<decltype(field)>::Type>::size), ...);
+    }, Std140Layout<T>::fields);
+    return offsets;
+}
+
+template <Std140Struct T>
+constexpr size_t Std140StructAlignment()
+{
+    size_t alignment = 16;  // structs are aligned like a vec4 at least
+    std::apply([&](const auto&... field) {
+        ((alignment = std::max(alignment, Std140Info<typename std::remove_cvref_t<decltype(field)>::Type>::alignment)), ...);
+    }, Std140Layout<T>::fields);
+    return alignment;
+}
+
+template <Std140Struct T>
+constexpr size_t Std140StructSize()
+{
+    constexpr auto offsets = Std140Offsets<T>();
+    size_t end = 0, i = 0;
+    std::apply([&](const auto&... field) {
+        ((end = offsets[i++] + Std140Info<typename std::remove_cvref_t<decltype(field)>::Type>::size), ...);
+    }, Std140Layout<T>::fields);
+    return Std140RoundUp(end, Std140StructAlignment<T>());
+}
+
+// leaf types
+template <typename T> struct Std140Info {
+    static constexpr size_t alignment = Std140Leaf<T>::alignment;
+    static constexpr size_t size = Std140Leaf<T>::size;
+};
+// described structs
+template <Std140Struct T> struct Std140Info<T> {
+    static constexpr size_t alignment = Std140StructAlignment<T>();
+    static constexpr size_t size = Std140StructSize<T>();
+};
+// arrays: every element starts on a vec4 boundary
+template <typename T, size_t N> struct Std140Info<T[N]> {
+    static constexpr size_t alignment = Std140RoundUp(Std140Info<T>::alignment, 16);
+    static constexpr size_t stride = Std140RoundUp(Std140Info<T>::size, 16);
+    static constexpr size_t size = stride * N;
+};
+
+template <typename T>
+constexpr size_t Std140Size = Std140Info<T>::size;
+
+// writes value in std140 layout to dst, which must hold Std140Size<T> bytes. Padding is left untouched.
+template <typename T>
+void Std140Pack(const T& value, unsigned char* dst)
+{
+    if constexpr (std::is_array_v<T>)
+    {
+        typedef std::remove_extent_t<T> Element;
+        for (size_t i = 0; i < std::extent_v<T>; i++)
+            Std140Pack<Element>(value[i], dst + i * Std140Info<T>::stride);
+    }
+    else if constexpr (Std140Struct<T>)
+    {
+        constexpr auto offsets = Std140Offsets<T>();
+        size_t i = 0;
+        std::apply([&](const auto&... field) {
+            ((Std140Pack(value.*field.member, dst + offsets[i++])), ...);
+        }, Std140Layout<T>::fields);
+    }
+    else
+        Std140Leaf<T>::Write(dst, value);
+}
+
+// calls visit(name, offset) for every leaf of T, named the way glGetActiveUniformName reports block members
+template <typename T>
+void Std140Visit(const std::string& name, size_t offset, const std::function<void(const std::string&, size_t)>& visit)
+{
+    if constexpr (std::is_array_v<T>)
+    {
+        typedef std::remove_extent_t<T> Element;
+        // arrays of leaves are a single active uniform named after their first element
+        if constexpr (!std::is_array_v<Element> && !Std140Struct<Element>)
+            visit(name + "[0]", offset);
+        else
+            for (size_t i = 0; i < std::extent_v<T>; i++)
+                Std140Visit<Element>(name + "[" + std::to_string(i) + "]", offset + i * Std140Info<T>::stride, visit);
+    }
+    else if constexpr (Std140Struct<T>)
+    {
+        constexpr auto offsets = Std140Offsets<T>();
+        size_t i = 0;
+        std::apply([&](const auto&... field) {
+            ((Std140Visit<typename std::remove_cvref_t<decltype(field)>::Type>(
+                  name.empty() ? std::string(field.name) : name + "." + field.name, offset + offsets[i++], visit)), ...);
+        }, Std140Layout<T>::fields);
+    }
+    else
+        visit(name, offset);
+}
+
+// compares T's layout with what the linker made of the uniform block blockName in program, reporting every member
+// whose offset differs or that only one side has. A program without that block passes.
+template <Std140Struct T>
+bool ValidateStd140Block(GLuint program, const char* blockName)
+{
+    GLuint index = glGetUniformBlockIndex(program, blockName);
+    if (index == GL_INVALID_INDEX)
+        return true;
+
+    GLint memberCount = 0, dataSize = 0;
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &memberCount);
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+    std::vector<GLint> members(memberCount);
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, members.data());
+    std::vector<GLuint> indices(members.begin(), members.end());
+    std::vector<GLint> offsets(memberCount);
+    glGetActiveUniformsiv(program, memberCount, indices.data(), GL_UNIFORM_OFFSET, offsets.data());
+
+    std::map<std::string, size_t> reported;
+    for (GLint i = 0; i < memberCount; i++)
+    {
+        GLchar name[256];
+        GLsizei length = 0;
+        glGetActiveUniformName(program, indices[i], sizeof(name), &length, name);
+        reported[std::string(name, length)] = (size_t)offsets[i];
+    }
+
+    bool valid = true;
+    Std140Visit<T>("", 0, [&](const std::string& name, size_t offset) {
+        auto found = reported.find(name);
+        if (found == reported.end())
+        {
+            std::cout << "ERROR::STD140::MEMBER_NOT_IN_BLOCK: " << blockName << " " << name << std::endl;
+            valid = false;
+            return;
+        }
+        if (found->second != offset)
+        {
+            std::cout << "ERROR::STD140::OFFSET_MISMATCH: " << blockName << " " << name << " is at " << found->second
+                      << ", the C++ layout says " << offset << std::endl;
+            valid = false;
+        }
+        reported.erase(found);
+    });
+    for (const auto& member : reported)
+    {
+        std::cout << "ERROR::STD140::MEMBER_NOT_DESCRIBED: " << blockName << " " << member.first << std::endl;
+        valid = false;
+    }
+    if ((size_t)dataSize < Std140Size<T>)
+    {
+        std::cout << "ERROR::STD140::BLOCK_TOO_SMALL: " << blockName << " has " << dataSize << " bytes, the C++ layout "
+                  << Std140Size<T> << std::endl;
+        valid = false;
+    }
+    return valid;
+}
+
+// The layout rules above, checked against hand-worked std140 offsets (OpenGL 4.6 spec, section 7.6.2.2) of small
+// structs covering each rule. Nothing here is used at runtime.
+namespace Std140Checks
+{
+    struct Vec3Float { glm::vec3 a; float b; };
+    struct FloatVec2 { float a; glm::vec2 b; };
+    struct FloatVec3 { float a; glm::vec3 b; };
+    struct FloatArray { float a[3]; float b; };
+    struct Mat3Float { glm::mat3 a; float b; };
+    struct Inner { float x; };
+    struct Nested { float a; Inner b; float c; Inner d[2]; glm::vec2 e; };
+}
+template <> struct Std140Layout<Std140Checks::Vec3Float> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::Vec3Float, a), STD140_MEMBER(Std140Checks::Vec3Float, b));
+};
+template <> struct Std140Layout<Std140Checks::FloatVec2> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::FloatVec2, a), STD140_MEMBER(Std140Checks::FloatVec2, b));
+};
+template <> struct Std140Layout<Std140Checks::FloatVec3> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::FloatVec3, a), STD140_MEMBER(Std140Checks::FloatVec3, b));
+};
+template <> struct Std140Layout<Std140Checks::FloatArray> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::FloatArray, a), STD140_MEMBER(Std140Checks::FloatArray, b));
+};
+template <> struct Std140Layout<Std140Checks::Mat3Float> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::Mat3Float, a), STD140_MEMBER(Std140Checks::Mat3Float, b));
+};
+template <> struct Std140Layout<Std140Checks::Inner> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(Std140Checks::Inner, x));
+};
+template <> struct Std140Layout<Std140Checks::Nested> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(Std140Checks::Nested, a), STD140_MEMBER(Std140Checks::Nested, b), STD140_MEMBER(Std140Checks::Nested, c),
+        STD140_MEMBER(Std140Checks::Nested, d), STD140_MEMBER(Std140Checks::Nested, e));
+};
+// a scalar fills the fourth component of the vec3 before it
+static_assert(Std140Offsets<Std140Checks::Vec3Float>() == std::array<size_t, 2>{ 0, 12 } && Std140Size<Std140Checks::Vec3Float> == 16);
+// a vec2 is aligned to 8, and a struct's size rounds up to 16
+static_assert(Std140Offsets<Std140Checks::FloatVec2>() == std::array<size_t, 2>{ 0, 8 } && Std140Size<Std140Checks::FloatVec2> == 16);
+// a vec3 is aligned to 16
+static_assert(Std140Offsets<Std140Checks::FloatVec3>() == std::array<size_t, 2>{ 0, 16 } && Std140Size<Std140Checks::FloatVec3> == 32);
+// array elements, scalars too, are 16 bytes apart
+static_assert(Std140Info<float[3]>::stride == 16 && Std140Size<float[3]> == 48);
+static_assert(Std140Offsets<Std140Checks::FloatArray>() == std::array<size_t, 2>{ 0, 48 } && Std140Size<Std140Checks::FloatArray> == 64);
+// a mat3 is three vec4 columns
+static_assert(Std140Offsets<Std140Checks::Mat3Float>() == std::array<size_t, 2>{ 0, 48 } && Std140Size<Std140Checks::Mat3Float> == 64);
+// a struct is aligned to 16 and padded to a multiple of 16, alone and as an array element
+static_assert(Std140Size<Std140Checks::Inner> == 16 && Std140Info<Std140Checks::Inner[2]>::stride == 16);
+static_assert(Std140Offsets<Std140Checks::Nested>() == std::array<size_t, 5>{ 0, 16, 32, 48, 80 } && Std140Size<Std140Checks::Nested> == 96);
+
+// A uniform buffer holding one std140 block of type T, bound to a fixed binding point
+template <Std140Struct T>
+class Std140Buffer
+{
+public:
+    explicit Std140Buffer(GLuint binding)
+    {
+        glGenBuffers(1, &buffer);
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, Std140Size<T>, NULL, GL_DYNAMIC_DRAW);
+        GLState().BindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+    ~Std140Buffer()
+    {
+        GLState().DeleteBuffer(buffer);
+    }
+
+    Std140Buffer(const Std140Buffer&) = delete;
+    Std140Buffer& operator=(const Std140Buffer&) = delete;
+
+    void Update(const T& value)
+    {
+        Std140Pack(value, staging.data());
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+    }
+
+private:
+    unsigned int buffer = 0;
+    std::array<unsigned char, Std140Size<T>> staging{};
+};
+#endif
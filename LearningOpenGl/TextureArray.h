@@ -0,0 +1,103 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+
+#include "GLStateCache.h"
+#include "TextureCache.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+// pixel format matching a component count of decoded texels
+inline GLenum TextureFormat(int components)
+{
+    if (components == 1)
+        return GL_RED;
+    if (components == 2)
+        return GL_RG;
+    if (components == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+// where a packed texture ended up
+struct TextureArrayLayer {
+    unsigned int array = 0;
+    int layer = -1;
+};
+
+// Packs decoded textures into GL_TEXTURE_2D_ARRAYs: textures with the same size, component count and number of mip
+// levels become layers of one array, so everything that shares a format can be sampled through a single binding.
+// A texture that matches no other simply gets an array of its own.
+class TextureArrayPacker
+{
+public:
+    // adds a texture to pack; the levels must stay valid until Build. Returns the index to pass to Placement.
+    int Add(const TextureLevels& levels)
+    {
+        Format format{ levels.width, levels.height, levels.components, levels.levelCount };
+        auto group = groupIndex.find(format);
+        if (group == groupIndex.end())
+        {
+            group = groupIndex.insert({ format, (int)groups.size() }).first;
+            groups.emplace_back();
+        }
+        std::vector<TextureLevels>& layers = groups[group->second];
+        placements.push_back({ group->second, (int)layers.size() });
+        layers.push_back(levels);
+        return (int)placements.size() - 1;
+    }
+
+    // creates and fills one array per group and returns them; the texels passed to Add aren't needed after this
+    std::vector<unsigned int> Build(bool generateMipmaps)
+    {
+        arrays.assign(groups.size(), 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            const std::vector<TextureLevels>& layers = groups[g];
+            const TextureLevels& first = layers[0];
+            GLenum format = TextureFormat(first.components);
+            glGenTextures(1, &arrays[g]);
+            GLState().BindTexture(GL_TEXTURE_2D_ARRAY, arrays[g]);
+            for (int level = 0; level < first.levelCount; level++)
+            {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, first.LevelWidth(level), first.LevelHeight(level), (GLsizei)layers.size(), 0,
+                             format, GL_UNSIGNED_BYTE, NULL);
+                for (size_t layer = 0; layer < layers.size(); layer++)
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)layer, first.LevelWidth(level), first.LevelHeight(level), 1,
+                                    format, GL_UNSIGNED_BYTE, layers[layer].levels[level]);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.levelCount - 1);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, generateMipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        groups.clear();
+        groupIndex.clear();
+        return arrays;
+    }
+
+    // the array and layer the texture added as index was packed into; valid after Build
+    TextureArrayLayer Placement(int index) const
+    {
+        return { arrays[placements[index].group], placements[index].layer };
+    }
+
+private:
+    typedef std::tuple<int, int, int, int> Format;  // width, height, components, levelCount
+    struct Placed {
+        int group;
+        int layer;
+    };
+
+    std::map<Format, int> groupIndex;
+    std::vector<std::vector<TextureLevels>> groups;
+    std::vector<Placed> placements;
+    std::vector<unsigned int> arrays;
+};
+#endif
@@ -0,0 +1,381 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+// a full mip chain never has more levels than this (32 levels covers any 32-bit texture size)
+const int TEXTURE_MAX_LEVELS = 32;
+// largest width or height the texture cache accepts, far above what any GL implementation can upload
+const uint32_t TEXTURE_MAX_DIMENSION = 1u << 16;
+
+// options that change the decoded texels and therefore take part in the cache key
+struct TextureDecodeOptions {
+    bool flipVertically = false;
+    bool generateMipmaps = true;
+};
+
+// non-owning description of a decoded texture and its mip chain. The level pointers either point into a
+// heap buffer (freshly decoded) or straight into a mapped cache file (warm start).
+struct TextureLevels {
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    int levelCount = 0;
+    const unsigned char* levels[TEXTURE_MAX_LEVELS] = {};
+
+    int LevelWidth(int level) const { return width >> level > 0 ? width >> level : 1; }
+    int LevelHeight(int level) const { return height >> level > 0 ? height >> level : 1; }
+    size_t LevelSize(int level) const { return static_cast<size_t>(LevelWidth(level)) * LevelHeight(level) * components; }
+
+    // the same texels with the first count levels left out, so level count becomes the new base
+    TextureLevels DropLevels(int count) const
+    {
+        TextureLevels dropped;
+        dropped.width = LevelWidth(count);
+        dropped.height = LevelHeight(count);
+        dropped.components = components;
+        dropped.levelCount = levelCount - count;
+        for (int level = 0; level < dropped.levelCount; level++)
+            dropped.levels[level] = levels[level + count];
+        return dropped;
+    }
+};
+
+// 64-bit FNV-1a style hash, folding in eight bytes per step so hashing a texture file stays far cheaper than decoding it.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint64_t prime = 1099511628211ull;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ bytes[i]) * prime;
+    return hash;
+}
+
+// cache key for an encoded image: its content hash combined with every option that affects the decoded result
+inline uint64_t TextureCacheKey(const unsigned char* fileData, size_t fileSize, const TextureDecodeOptions& options)
+{
+    uint64_t hash = HashBytes(fileData, fileSize);
+    const unsigned char optionBits[2] = { (unsigned char)options.flipVertically, (unsigned char)options.generateMipmaps };
+    return HashBytes(optionBits, sizeof(optionBits), hash);
+}
+
+// number of levels in a full mip chain for the given base size, down to and including 1x1
+inline int MipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while ((width > 1 || height > 1) && levels < TEXTURE_MAX_LEVELS)
+    {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        levels++;
+    }
+    return levels;
+}
+
+#ifdef TEXTURE_SSE2
+// HalveRowSse2 for 3 component pixels, which don't line up with 16 byte loads. Each step sums 8 source pixels
+// (24 bytes) of both rows into three vectors of 8 lanes, adds every lane to the one 3 lanes (a pixel) further on,
+// and gathers the 12 sums that start a pixel pair into 4 output pixels.
+inline int HalveRowSse2Rgb(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int dstWidth)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i keep012 = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+    const __m128i keep34 = _mm_setr_epi16(0, 0, 0, -1, -1, 0, 0, 0);
+    const __m128i keep5 = _mm_setr_epi16(0, 0, 0, 0, 0, -1, 0, 0);
+    const __m128i keep67 = _mm_setr_epi16(0, 0, 0, 0, 0, 0, -1, -1);
+    const __m128i keep0 = _mm_setr_epi16(-1, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i keep123 = _mm_setr_epi16(0, -1, -1, -1, 0, 0, 0, 0);
+    int x = 0;
+    for (; x + 4 <= dstWidth; x += 4)
+    {
+        const unsigned char* src0 = row0 + x * 6;
+        const unsigned char* src1 = row1 + x * 6;
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 8));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 8));
+        // bytes 0-7, 8-15 and 16-23 of the two rows added together
+        __m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i v2 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        // lane i of s0, s1 and s2 is byte i plus byte i + 3 (counting from 0, 8 and 16)
+        __m128i s0 = _mm_add_epi16(v0, _mm_or_si128(_mm_srli_si128(v0, 6), _mm_slli_si128(v1, 10)));
+        __m128i s1 = _mm_add_epi16(v1, _mm_or_si128(_mm_srli_si128(v1, 6), _mm_slli_si128(v2, 10)));
+        __m128i s2 = _mm_add_epi16(v2, _mm_srli_si128(v2, 6));
+        // the output pixels are the sums starting at bytes 0, 6, 12 and 18
+        __m128i lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(s0, keep012), _mm_and_si128(_mm_srli_si128(s0, 6), keep34)),
+                                  _mm_or_si128(_mm_and_si128(_mm_slli_si128(s1, 10), keep5), _mm_and_si128(_mm_slli_si128(s1, 4), keep67)));
+        __m128i hi = _mm_or_si128(_mm_and_si128(_mm_srli_si128(s1, 12), keep0), _mm_and_si128(_mm_srli_si128(s2, 2), keep123));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        __m128i packed = _mm_packus_epi16(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 3), packed);
+        int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+        std::memcpy(out + x * 3 + 8, &last, 4);
+    }
+    return x;
+}
+
+// 2x2 box filter of as much of one output row as fits whole 16 byte loads; returns how many pixels it wrote.
+// Every load covers the source pixels of 8 output bytes (12 for 3 components), which both rows always have room for.
+inline int HalveRowSse2(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int dstWidth, int components)
+{
+    if (components == 3)
+        return HalveRowSse2Rgb(row0, row1, out, dstWidth);
+    const int step = 8 / components;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + step <= dstWidth; x += step)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 2 * components));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 2 * components));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        // add every pixel to its right neighbour and gather the sums into 8 lanes
+        __m128i sums;
+        if (components == 1)
+            sums = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+        else if (components == 2)
+        {
+            lo = _mm_shuffle_epi32(_mm_add_epi16(lo, _mm_srli_epi64(lo, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+            hi = _mm_shuffle_epi32(_mm_add_epi16(hi, _mm_srli_epi64(hi, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+            sums = _mm_unpacklo_epi64(lo, hi);
+        }
+        else
+            sums = _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+        sums = _mm_srli_epi16(_mm_add_epi16(sums, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * components), _mm_packus_epi16(sums, sums));
+    }
+    return x;
+}
+#endif
+
+// 2x2 box filter of a whole image into dst, which is half its size (but at least 1x1). Odd edges reuse their last
+// row/column. Where SSE2 is available most of each row is filtered 16 bytes at a time.
+inline void HalveImage(const unsigned char* src, int srcWidth, int srcHeight, int components, unsigned char* dst)
+{
+    int dstWidth = srcWidth > 1 ? srcWidth / 2 : 1;
+    int dstHeight = srcHeight > 1 ? srcHeight / 2 : 1;
+    size_t srcStride = static_cast<size_t>(srcWidth) * components;
+    for (int y = 0; y < dstHeight; y++)
+    {
+        const unsigned char* row0 = src + (2 * y < srcHeight ? 2 * y : srcHeight - 1) * srcStride;
+        const unsigned char* row1 = src + (2 * y + 1 < srcHeight ? 2 * y + 1 : srcHeight - 1) * srcStride;
+        unsigned char* out = dst + static_cast<size_t>(y) * dstWidth * components;
+        int x = 0;
+#ifdef TEXTURE_SSE2
+        if (srcWidth > 1)
+            x = HalveRowSse2(row0, row1, out, dstWidth, components);
+#endif
+        for (; x < dstWidth; x++)
+        {
+            int x0 = (2 * x < srcWidth ? 2 * x : srcWidth - 1) * components;
+            int x1 = (2 * x + 1 < srcWidth ? 2 * x + 1 : srcWidth - 1) * components;
+            for (int c = 0; c < components; c++)
+                out[x * components + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+        }
+    }
+}
+
+// builds the mip chain of a decoded image into storage (base level first, levels back to back) and fills in levels
+// to point into it. Each level is HalveImage of the one above.
+inline void BuildMipChain(const unsigned char* pixels, int width, int height, int components, bool generateMipmaps,
+                          std::vector<unsigned char>& storage, TextureLevels& levels)
+{
+    levels.width = width;
+    levels.height = height;
+    levels.components = components;
+    levels.levelCount = generateMipmaps ? MipLevelCount(width, height) : 1;
+
+    size_t total = 0;
+    for (int level = 0; level < levels.levelCount; level++)
+        total += levels.LevelSize(level);
+    storage.resize(total);
+
+    unsigned char* dst = storage.data();
+    std::memcpy(dst, pixels, levels.LevelSize(0));
+    levels.levels[0] = dst;
+    for (int level = 1; level < levels.levelCount; level++)
+    {
+        const unsigned char* src = dst;
+        dst += levels.LevelSize(level - 1);
+        HalveImage(src, levels.LevelWidth(level - 1), levels.LevelHeight(level - 1), components, dst);
+        levels.levels[level] = dst;
+    }
+}
+
+// A decoded texture read back from the cache. The level pointers stay valid for as long as this object (and
+// therefore its mapping) lives.
+struct CachedTexture {
+    MappedFile file;
+    TextureLevels levels;
+};
+
+// Persistent on-disk cache of decoded textures. Every entry is a single raw file named after its key: a fixed
+// header followed by the uncompressed mip chain, with each level at a 16-byte aligned offset, so a warm start
+// is just a mapping of the file and an upload straight out of it.
+class TextureCache
+{
+public:
+    std::string directory;
+
+    explicit TextureCache(std::string directory = "texture_cache") : directory(std::move(directory))
+    {
+    }
+
+    // maps the entry for key into out. Returns false on a miss. An entry that is truncated, from another format
+    // version or otherwise doesn't describe a texture that fits in the file counts as a miss too, and is deleted.
+    bool Load(uint64_t key, CachedTexture& out) const
+    {
+        std::string path = entryPath(key);
+        if (!out.file.Open(path))
+            return false;
+        const unsigned char* data = out.file.Data();
+        size_t size = out.file.Size();
+        Header header;
+        if (size < sizeof(Header))
+            return reject(out, path);
+        std::memcpy(&header, data, sizeof(Header));
+        // bounding the dimensions keeps every level size below 2^34 bytes, so the size checks below can't overflow
+        if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.key != key ||
+            header.width < 1 || header.width > TEXTURE_MAX_DIMENSION || header.height < 1 || header.height > TEXTURE_MAX_DIMENSION ||
+            header.components < 1 || header.components > 4 ||
+            header.levelCount < 1 || header.levelCount > (uint32_t)MipLevelCount((int)header.width, (int)header.height))
+            return reject(out, path);
+
+        TextureLevels& levels = out.levels;
+        levels.width = (int)header.width;
+        levels.height = (int)header.height;
+        levels.components = (int)header.components;
+        levels.levelCount = (int)header.levelCount;
+        for (int level = 0; level < levels.levelCount; level++)
+        {
+            uint64_t offset = header.levelOffsets[level];
+            if (offset > size || levels.LevelSize(level) > size - offset)
+                return reject(out, path);
+            levels.levels[level] = data + offset;
+        }
+        return true;
+    }
+
+    // writes levels as the entry for key. The entry is written to a temporary file and renamed into place so a
+    // concurrent or interrupted run never sees a half written file.
+    bool Store(uint64_t key, const TextureLevels& levels) const
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+
+        Header header;
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, MAGIC, 4);
+        header.version = VERSION;
+        header.key = key;
+        header.width = (uint32_t)levels.width;
+        header.height = (uint32_t)levels.height;
+        header.components = (uint32_t)levels.components;
+        header.levelCount = (uint32_t)levels.levelCount;
+        uint64_t offset = alignUp(sizeof(Header));
+        for (int level = 0; level < levels.levelCount; level++)
+        {
+            header.levelOffsets[level] = offset;
+            offset = alignUp(offset + levels.LevelSize(level));
+        }
+
+        std::string path = entryPath(key);
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cout << "ERROR::TEXTURE_CACHE::FILE_NOT_SUCCESSFULLY_WRITTEN: " << tempPath << std::endl;
+                return false;
+            }
+            const char padding[16] = {};
+            uint64_t written = sizeof(Header);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            for (int level = 0; level < levels.levelCount; level++)
+            {
+                file.write(padding, (std::streamsize)(header.levelOffsets[level] - written));
+                file.write(reinterpret_cast<const char*>(levels.levels[level]), (std::streamsize)levels.LevelSize(level));
+                written = header.levelOffsets[level] + levels.LevelSize(level);
+            }
+            if (!file)
+            {
+                std::cout << "ERROR::TEXTURE_CACHE::FILE_NOT_SUCCESSFULLY_WRITTEN: " << tempPath << std::endl;
+                file.close();
+                std::filesystem::remove(tempPath, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tempPath, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr const char* MAGIC = "TXC1";
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t width;
+        uint32_t height;
+        uint32_t components;
+        uint32_t levelCount;
+        uint64_t levelOffsets[TEXTURE_MAX_LEVELS];
+    };
+
+    static uint64_t alignUp(uint64_t offset)
+    {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    // drops a broken entry, so the next Store writes a good one in its place
+    static bool reject(CachedTexture& out, const std::string& path)
+    {
+        out.file.Close();
+        out.levels = TextureLevels();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return false;
+    }
+
+    std::string entryPath(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)key);
+        return directory + '/' + name;
+    }
+};
+#endif
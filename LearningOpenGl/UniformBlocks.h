@@ -0,0 +1,132 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Std140.h"
+
+// C++ mirrors of the std140 uniform blocks shared by the shaders. Every member is a mat4 or vec4, so the C++ layout is
+// the std140 one without any padding (checked below). The GLSL side, which has to match exactly, is uniform_blocks.glsl;
+// shaders #include it.
+
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPosition;
+};
+
+struct ObjectBlock {
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+};
+
+template <> struct Std140Layout<FrameBlock> {
+    static constexpr auto fields = std::make_tuple(
+        STD140_MEMBER(FrameBlock, view), STD140_MEMBER(FrameBlock, projection), STD140_MEMBER(FrameBlock, viewProjection),
+        STD140_MEMBER(FrameBlock, cameraPosition));
+};
+template <> struct Std140Layout<ObjectBlock> {
+    static constexpr auto fields = std::make_tuple(STD140_MEMBER(ObjectBlock, model), STD140_MEMBER(ObjectBlock, normalMatrix));
+};
+// both are uploaded with a plain copy, which is only right while the layouts have no padding
+static_assert(Std140Size<FrameBlock> == sizeof(FrameBlock), "FrameBlock doesn't match its std140 layout");
+static_assert(Std140Size<ObjectBlock> == sizeof(ObjectBlock), "ObjectBlock doesn't match its std140 layout");
+static_assert(Std140Offsets<FrameBlock>() == std::array<size_t, 4>{ 0, 64, 128, 192 } && Std140Size<FrameBlock> == 208);
+static_assert(Std140Offsets<ObjectBlock>() == std::array<size_t, 2>{ 0, 64 } && Std140Size<ObjectBlock> == 128);
+
+// The per-frame block: written once per frame and bound to FRAME_BLOCK_BINDING, where every program that declares
+// it sees it.
+class FrameUniforms
+{
+public:
+    FrameUniforms()
+    {
+        glGenBuffers(1, &buffer);
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+        GLState().BindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, buffer);
+    }
+    ~FrameUniforms()
+    {
+        GLState().DeleteBuffer(buffer);
+    }
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    void Update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition)
+    {
+        FrameBlock block;
+        block.view = view;
+        block.projection = projection;
+        block.viewProjection = projection * view;
+        block.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &block);
+    }
+
+private:
+    unsigned int buffer = 0;
+};
+
+// The per-object block. Each object drawn in a frame gets its own slice of one buffer, bound to OBJECT_BLOCK_BINDING
+// with glBindBufferRange just before its draw, so no draw waits for the GPU to finish reading the previous object's
+// matrices. The normal matrix is computed here once per object instead of per vertex in the shader.
+class ObjectUniforms
+{
+public:
+    explicit ObjectUniforms(int objectsPerFrame = 1024) : objectsPerFrame(objectsPerFrame)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = (sizeof(ObjectBlock) + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &buffer);
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, stride * objectsPerFrame, NULL, GL_STREAM_DRAW);
+    }
+    ~ObjectUniforms()
+    {
+        GLState().DeleteBuffer(buffer);
+    }
+
+    ObjectUniforms(const ObjectUniforms&) = delete;
+    ObjectUniforms& operator=(const ObjectUniforms&) = delete;
+
+    // call once per frame before the first Bind
+    void BeginFrame()
+    {
+        orphan();
+    }
+
+    // writes an object's block and binds it for the draws that follow
+    void Bind(const glm::mat4& model)
+    {
+        if (next == objectsPerFrame)
+            orphan();
+        ObjectBlock block;
+        block.model = model;
+        block.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+        GLintptr offset = (GLintptr)(stride * next++);
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(ObjectBlock), &block);
+        GLState().BindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, buffer, offset, sizeof(ObjectBlock));
+    }
+
+private:
+    unsigned int buffer = 0;
+    size_t stride = 0;
+    int objectsPerFrame;
+    int next = 0;
+
+    // gives the buffer fresh storage, so writing it again never has to wait for draws still reading the old contents
+    void orphan()
+    {
+        GLState().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, stride * objectsPerFrame, NULL, GL_STREAM_DRAW);
+        next = 0;
+    }
+};
+#endif
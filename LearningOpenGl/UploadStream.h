@@ -0,0 +1,201 @@
+#ifndef UPLOAD_STREAM_H
+#define UPLOAD_STREAM_H
+
+#include <glad/glad.h>
+
+#include "GLStateCache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Streams texture and buffer contents to the GPU through one staging buffer used as a ring. Each upload is queued
+// and, when its frame comes, its fill function copies the source bytes into a mapped slice of the ring; the GL copy
+// out of that slice then runs asynchronously instead of stalling on client memory like glTexImage2D/glBufferData do.
+// The fill copies from wherever the data already is, e.g. a mapped texture cache file. stb_image can't decode into the
+// ring, as it always decodes into memory of its own; texture mips can be built in the fill (see CopyTextureLevels),
+// but through a scratch buffer, since reading back from mapped (write-combined) memory is slow.
+// Update() submits queued uploads until the per-frame byte budget is spent, so streaming in a large model is spread
+// over several frames instead of causing a spike. Every frame's slice of the ring is fenced and only written again
+// once the GPU is done reading it.
+//
+// Requires a current GL context for its whole lifetime; all calls must come from the thread that owns it.
+class UploadStream
+{
+public:
+    // writes the size bytes of an upload's source data to dst
+    typedef std::function<void(unsigned char* dst)> FillFunction;
+    // issues the GL copy for an upload. When staged, src is the offset of the data in the ring buffer, which is bound
+    // to GL_PIXEL_UNPACK_BUFFER and GL_COPY_READ_BUFFER; otherwise it is a plain pointer to client memory.
+    typedef std::function<void(const unsigned char* src, bool staged)> SubmitFunction;
+
+    size_t frameBudget;
+
+    explicit UploadStream(size_t capacity = 64u << 20, size_t frameBudget = 8u << 20) : frameBudget(frameBudget), capacity(capacity)
+    {
+        glGenBuffers(1, &ring);
+        GLState().BindBuffer(GL_COPY_READ_BUFFER, ring);
+        glBufferData(GL_COPY_READ_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    }
+    ~UploadStream()
+    {
+        for (Region& region : regions)
+            glDeleteSync(region.sync);
+        GLState().DeleteBuffer(ring);
+    }
+
+    UploadStream(const UploadStream&) = delete;
+    UploadStream& operator=(const UploadStream&) = delete;
+
+    // queues an upload of size bytes and returns its ticket; see IsSubmitted
+    uint64_t Queue(size_t size, FillFunction fill, SubmitFunction submit)
+    {
+        queued.push_back({ size, std::move(fill), std::move(submit), ++lastQueued });
+        return lastQueued;
+    }
+
+    // queues a copy of size bytes into buffer at offset. The buffer must already have storage (glBufferData with NULL).
+    uint64_t QueueBuffer(unsigned int buffer, size_t offset, size_t size, FillFunction fill)
+    {
+        return Queue(size, std::move(fill), [buffer, offset, size](const unsigned char* src, bool staged) {
+            GLState().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            if (staged)
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)src, offset, size);
+            else
+                glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, src);
+        });
+    }
+
+    // whether the upload with this ticket has been issued to GL, so commands issued from now on see its data.
+    // Ticket 0 stands for "nothing to wait for".
+    bool IsSubmitted(uint64_t ticket) const { return ticket <= lastSubmitted; }
+    bool IsIdle() const { return queued.empty(); }
+
+    // call once per frame: fences the previous frame's uploads and submits queued ones until frameBudget bytes have
+    // gone out. At least one upload is submitted per call, however large, so nothing waits forever.
+    void Update()
+    {
+        closeRegion();
+        size_t sent = 0;
+        while (!queued.empty() && (sent == 0 || sent + queued.front().size <= frameBudget))
+        {
+            sent += queued.front().size;
+            submitFront();
+        }
+    }
+
+    // submits everything still queued right away, e.g. behind a loading screen
+    void Flush()
+    {
+        closeRegion();
+        while (!queued.empty())
+            submitFront();
+    }
+
+private:
+    struct Upload {
+        size_t size;
+        FillFunction fill;
+        SubmitFunction submit;
+        uint64_t ticket;
+    };
+    // a fenced slice of the ring the GPU may still be reading from
+    struct Region {
+        size_t begin;
+        size_t end;
+        GLsync sync;
+    };
+
+    size_t capacity;
+    unsigned int ring = 0;
+    size_t head = 0;            // where the next allocation starts looking
+    size_t regionBegin = 0;     // start of the slice written since the last fence
+    std::deque<Region> regions;
+    std::deque<Upload> queued;
+    uint64_t lastQueued = 0;
+    uint64_t lastSubmitted = 0;
+
+    void submitFront()
+    {
+        Upload upload = std::move(queued.front());
+        queued.pop_front();
+
+        // an upload the ring can never hold goes the synchronous way from a temporary copy
+        if (upload.size > capacity)
+        {
+            std::vector<unsigned char> data(upload.size);
+            upload.fill(data.data());
+            upload.submit(data.data(), false);
+            lastSubmitted = upload.ticket;
+            return;
+        }
+
+        size_t offset = allocate(upload.size);
+        GLState().BindBuffer(GL_COPY_READ_BUFFER, ring);
+        // the fences guarantee the GPU is done with this range, so the driver doesn't need to synchronise for us
+        void* dst = glMapBufferRange(GL_COPY_READ_BUFFER, offset, upload.size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst != nullptr)
+        {
+            upload.fill(static_cast<unsigned char*>(dst));
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            GLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+            upload.submit(reinterpret_cast<const unsigned char*>(offset), true);
+            GLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        else
+        {
+            std::vector<unsigned char> data(upload.size);
+            upload.fill(data.data());
+            upload.submit(data.data(), false);
+        }
+        lastSubmitted = upload.ticket;
+    }
+
+    // reserves size bytes of the ring, waiting for the GPU where it still reads from them
+    size_t allocate(size_t size)
+    {
+        size_t offset = (head + 15) & ~size_t(15);
+        if (offset + size > capacity)
+        {
+            // wrapping around: fence what this frame wrote at the end of the ring before writing over the start
+            closeRegion();
+            offset = 0;
+            regionBegin = 0;
+        }
+        while (!regions.empty() && overlapsFenced(offset, offset + size))
+        {
+            GLenum status;
+            do
+                status = glClientWaitSync(regions.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            while (status == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(regions.front().sync);
+            regions.pop_front();
+        }
+        head = offset + size;
+        return offset;
+    }
+
+    bool overlapsFenced(size_t begin, size_t end) const
+    {
+        for (const Region& region : regions)
+            if (begin < region.end && region.begin < end)
+                return true;
+        return false;
+    }
+
+    // fences everything written since the last fence
+    void closeRegion()
+    {
+        if (head != regionBegin)
+            regions.push_back({ regionBegin, head, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+        regionBegin = head;
+    }
+};
+
+// the stream uploads are queued on; set it once a context exists. While null everything uploads synchronously. It is
+// per thread, since a stream belongs to one context: loads running on a GLLoaderThread upload directly on theirs.
+inline thread_local UploadStream* activeUploadStream = nullptr;
+#endif
@@ -0,0 +1,539 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+#include "MappedFile.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// virtual textures are cut into tiles of VT_TILE_SIZE texels square, each stored with a VT_TILE_BORDER texel border
+// copied from its neighbours so bilinear filtering inside a page never reads another tile
+const int VT_TILE_SIZE = 128;
+const int VT_TILE_BORDER = 4;
+const int VT_PAGE_SIZE = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+const size_t VT_PAGE_BYTES = static_cast<size_t>(VT_PAGE_SIZE) * VT_PAGE_SIZE * 4;
+
+// number of tiles across a mip level of a texture that is size texels across at level 0
+inline int VirtualTileCount(int size, int level)
+{
+    int levelSize = size >> level > 0 ? size >> level : 1;
+    return (levelSize + VT_TILE_SIZE - 1) / VT_TILE_SIZE;
+}
+
+// On-disk layout of a pre-tiled texture: this header, then every tile of every level (finest first, tiles in row
+// major order) as a VT_PAGE_SIZE square of RGBA texels, so a tile goes to the GPU straight out of the mapped file.
+struct VirtualTextureHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t tileSize;
+    uint32_t tileBorder;
+    uint32_t reserved;
+    uint64_t levelOffsets[TEXTURE_MAX_LEVELS];
+};
+
+// writes levels (e.g. from BuildMipChain) as a pre-tiled virtual texture. Borders wrap around the texture edges, to
+// match the GL_REPEAT wrapping of ordinary model textures.
+inline bool WriteVirtualTexture(const TextureLevels& levels, const std::string& path)
+{
+    VirtualTextureHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "VTX1", 4);
+    header.version = 1;
+    header.width = (uint32_t)levels.width;
+    header.height = (uint32_t)levels.height;
+    header.levelCount = (uint32_t)levels.levelCount;
+    header.tileSize = VT_TILE_SIZE;
+    header.tileBorder = VT_TILE_BORDER;
+    uint64_t offset = sizeof(header);
+    for (int level = 0; level < levels.levelCount; level++)
+    {
+        header.levelOffsets[level] = offset;
+        offset += VirtualTileCount(levels.width, level) * VirtualTileCount(levels.height, level) * VT_PAGE_BYTES;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_SUCCESSFULLY_WRITTEN: " << path << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<unsigned char> page(VT_PAGE_BYTES);
+    for (int level = 0; level < levels.levelCount; level++)
+    {
+        int width = levels.LevelWidth(level);
+        int height = levels.LevelHeight(level);
+        const unsigned char* texels = levels.levels[level];
+        int components = levels.components;
+        for (int ty = 0; ty < VirtualTileCount(levels.height, level); ty++)
+        {
+            for (int tx = 0; tx < VirtualTileCount(levels.width, level); tx++)
+            {
+                unsigned char* out = page.data();
+                for (int y = 0; y < VT_PAGE_SIZE; y++)
+                {
+                    int sy = ((ty * VT_TILE_SIZE - VT_TILE_BORDER + y) % height + height) % height;
+                    for (int x = 0; x < VT_PAGE_SIZE; x++, out += 4)
+                    {
+                        int sx = ((tx * VT_TILE_SIZE - VT_TILE_BORDER + x) % width + width) % width;
+                        const unsigned char* in = texels + (static_cast<size_t>(sy) * width + sx) * components;
+                        // grey and grey/alpha spread over RGB like GL_LUMINANCE(_ALPHA) would
+                        out[0] = in[0];
+                        out[1] = components >= 3 ? in[1] : in[0];
+                        out[2] = components >= 3 ? in[2] : in[0];
+                        out[3] = components == 4 ? in[3] : components == 2 ? in[1] : 255;
+                    }
+                }
+                file.write(reinterpret_cast<const char*>(page.data()), (std::streamsize)page.size());
+            }
+        }
+    }
+    return (bool)file;
+}
+
+// Sparse virtual texturing: any number of pre-tiled textures share one physical cache texture of a fixed number of
+// pages, so video memory use doesn't grow with the texture set. Each virtual texture has an indirection texture
+// (one layer per mip level, one texel per tile) that points the fragment shader (virtual_texture.fs) at the page
+// holding the tile it needs, or at the closest coarser tile that is resident.
+//
+// Which tiles are needed comes from a feedback pass: between BeginFeedback and EndFeedback the scene is drawn at low
+// resolution with virtual_texture_feedback.fs, which writes the tile every pixel wants. That image is read back
+// through a ring of pixel pack buffers a few frames later, so the GPU never stalls on it, and Update() then pages
+// the missing tiles in from their mapped files, evicting the least recently used pages.
+class VirtualTextureSystem
+{
+public:
+    int tilesPerFrame;          // most tiles paged in per Update, to keep frame times even
+
+    // pagesAcross is the physical cache size in pages along each side (at most 255, and no more than fit in the
+    // largest texture GL allows); feedbackDivisor how much smaller than the screen the feedback pass renders
+    explicit VirtualTextureSystem(int pagesAcross = 16, int feedbackDivisor = 8, int tilesPerFrame = 16)
+        : tilesPerFrame(tilesPerFrame), pagesAcross(maxPagesAcross(pagesAcross)), feedbackDivisor(feedbackDivisor)
+    {
+        glGenTextures(1, &physical);
+        GLState().BindTexture(GL_TEXTURE_2D, physical);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, this->pagesAcross * VT_PAGE_SIZE, this->pagesAcross * VT_PAGE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        pages.resize(static_cast<size_t>(this->pagesAcross) * this->pagesAcross);
+    }
+    ~VirtualTextureSystem()
+    {
+        for (Readback& readback : readbacks)
+        {
+            if (readback.fence != nullptr)
+                glDeleteSync(readback.fence);
+            GLState().DeleteBuffer(readback.buffer);
+        }
+        for (std::unique_ptr<VirtualTexture>& texture : textures)
+            GLState().DeleteTexture(texture->indirection);
+        GLState().DeleteTexture(physical);
+        glDeleteFramebuffers(1, &feedbackFramebuffer);
+        glDeleteRenderbuffers(1, &feedbackColor);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+    }
+
+    VirtualTextureSystem(const VirtualTextureSystem&) = delete;
+    VirtualTextureSystem& operator=(const VirtualTextureSystem&) = delete;
+
+    // maps a file written by WriteVirtualTexture. Its coarsest tile is paged in right away and stays resident, so
+    // there is always something to sample. Returns the id to Bind it with, or -1.
+    int Add(const std::string& path)
+    {
+        auto texture = std::make_unique<VirtualTexture>();
+        if (!texture->file.Open(path) || texture->file.Size() < sizeof(VirtualTextureHeader))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return -1;
+        }
+        VirtualTextureHeader& header = texture->header;
+        std::memcpy(&header, texture->file.Data(), sizeof(header));
+        if (std::memcmp(header.magic, "VTX1", 4) != 0 || header.version != 1 || header.tileSize != VT_TILE_SIZE ||
+            header.tileBorder != VT_TILE_BORDER || header.levelCount < 1 || header.levelCount > TEXTURE_MAX_LEVELS)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::UNSUPPORTED_FILE: " << path << std::endl;
+            return -1;
+        }
+        for (int level = 0; level < (int)header.levelCount; level++)
+        {
+            size_t tiles = static_cast<size_t>(texture->TilesX(level)) * texture->TilesY(level);
+            if (header.levelOffsets[level] > texture->file.Size() || tiles * VT_PAGE_BYTES > texture->file.Size() - header.levelOffsets[level])
+            {
+                std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_TRUNCATED: " << path << std::endl;
+                return -1;
+            }
+        }
+        // ids have to fit the feedback image next to the tile coordinates
+        int id = (int)textures.size();
+        if (id >= 255)
+            return -1;
+
+        // the indirection texture: one layer per level, each as large as level 0's tile grid
+        texture->tables.resize(header.levelCount);
+        for (int level = 0; level < (int)header.levelCount; level++)
+            texture->tables[level].assign(static_cast<size_t>(texture->TilesX(level)) * texture->TilesY(level) * 4, 0);
+        glGenTextures(1, &texture->indirection);
+        GLState().BindTexture(GL_TEXTURE_2D_ARRAY, texture->indirection);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8UI, texture->TilesX(0), texture->TilesY(0), header.levelCount, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // the first level that is a single tile is the fallback for everything
+        texture->pinnedLevel = 0;
+        while (texture->TilesX(texture->pinnedLevel) > 1 || texture->TilesY(texture->pinnedLevel) > 1)
+            texture->pinnedLevel++;
+        textures.push_back(std::move(texture));
+        if (!pageIn(id, textures[id]->pinnedLevel, 0, 0, true))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::CACHE_FULL: " << path << std::endl;
+            textures.pop_back();
+            return -1;
+        }
+        updateIndirection(*textures[id]);
+        return id;
+    }
+
+    // binds virtual texture id's physical cache and indirection texture to the given units and sets the uniforms
+    // virtual_texture.fs and virtual_texture_feedback.fs read
+    void Bind(Shader& shader, int id, int physicalUnit = 0, int indirectionUnit = 1) const
+    {
+        const VirtualTexture& texture = *textures[id];
+        GLState().BindTexture(physicalUnit, GL_TEXTURE_2D, physical);
+        GLState().BindTexture(indirectionUnit, GL_TEXTURE_2D_ARRAY, texture.indirection);
+        shader.setInt("vtPhysical", physicalUnit);
+        shader.setInt("vtIndirection", indirectionUnit);
+        shader.setVec2("vtSize", (float)texture.header.width, (float)texture.header.height);
+        shader.setInt("vtLevelCount", (int)texture.header.levelCount);
+        shader.setFloat("vtPagesAcross", (float)pagesAcross);
+        shader.setInt("vtId", id);
+        // the feedback pass renders feedbackDivisor times smaller, so its derivatives are that much larger
+        shader.setFloat("vtFeedbackBias", -std::log2((float)feedbackDivisor));
+    }
+
+    // starts the feedback pass for a screen of width x height: binds the (smaller) feedback framebuffer and clears it.
+    // Draw everything that uses virtual textures with the feedback shader, then call EndFeedback.
+    void BeginFeedback(int width, int height)
+    {
+        int feedbackWidth = std::max(1, width / feedbackDivisor);
+        int feedbackHeight = std::max(1, height / feedbackDivisor);
+        if (feedbackWidth != this->feedbackWidth || feedbackHeight != this->feedbackHeight)
+            resizeFeedback(feedbackWidth, feedbackHeight);
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        const GLuint none[4] = { 0, 0, 0, 0xFFFF };
+        glClearBufferuiv(GL_COLOR, 0, none);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // queues the readback of the feedback image and restores the default framebuffer. If every readback buffer is
+    // still waiting for the GPU this frame's feedback is dropped rather than stalling.
+    void EndFeedback()
+    {
+        Readback* free = nullptr;
+        for (Readback& readback : readbacks)
+            if (readback.fence == nullptr)
+                free = &readback;
+        if (free != nullptr)
+        {
+            GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, free->buffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            free->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            free->frame = ++feedbackFrames;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    }
+
+    // call once per frame: consumes every feedback image the GPU has finished, then pages in up to tilesPerFrame of
+    // the tiles they asked for (coarsest first) and updates the indirection textures that changed
+    void Update()
+    {
+        frame++;
+        for (;;)
+        {
+            // oldest finished readback first
+            Readback* ready = nullptr;
+            for (Readback& readback : readbacks)
+                if (readback.fence != nullptr && (ready == nullptr || readback.frame < ready->frame))
+                    ready = &readback;
+            if (ready == nullptr || glClientWaitSync(ready->fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                break;
+            glDeleteSync(ready->fence);
+            ready->fence = nullptr;
+            collectRequests(*ready);
+        }
+
+        std::sort(wanted.begin(), wanted.end(), [](const Request& a, const Request& b) { return a.level > b.level; });
+        int loaded = 0;
+        for (const Request& request : wanted)
+        {
+            if (loaded == tilesPerFrame)
+                break;
+            if (textures[request.id]->resident.count(tileKey(request.level, request.x, request.y)))
+                continue;
+            if (!pageIn(request.id, request.level, request.x, request.y, false))
+                break;
+            loaded++;
+        }
+        wanted.clear();
+        for (std::unique_ptr<VirtualTexture>& texture : textures)
+            if (texture->dirty)
+                updateIndirection(*texture);
+    }
+
+    // pages in use, out of PageCount()
+    int ResidentPages() const
+    {
+        int count = 0;
+        for (const Page& page : pages)
+            count += page.texture >= 0;
+        return count;
+    }
+    int PageCount() const { return (int)pages.size(); }
+
+private:
+    // pagesAcross cut down to what the page cache texture can hold: the indirection texture stores page coordinates
+    // in 8 bits, and the cache texture can't be larger than GL_MAX_TEXTURE_SIZE
+    static int maxPagesAcross(int pagesAcross)
+    {
+        GLint maxTextureSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+        int fitting = std::max(1, std::min(255, (int)maxTextureSize / VT_PAGE_SIZE));
+        return std::clamp(pagesAcross, 1, fitting);
+    }
+
+    struct VirtualTexture {
+        MappedFile file;
+        VirtualTextureHeader header;
+        unsigned int indirection = 0;
+        int pinnedLevel = 0;
+        std::unordered_map<uint64_t, int> resident;             // tile key -> page
+        std::vector<std::vector<unsigned char>> tables;         // indirection texels per level
+        bool dirty = false;
+
+        int TilesX(int level) const { return VirtualTileCount((int)header.width, level); }
+        int TilesY(int level) const { return VirtualTileCount((int)header.height, level); }
+    };
+    // one slot of the physical cache
+    struct Page {
+        int texture = -1;
+        int level = 0;
+        int x = 0;
+        int y = 0;
+        uint64_t lastUsed = 0;
+        bool pinned = false;
+    };
+    struct Request {
+        int id;
+        int level;
+        int x;
+        int y;
+    };
+    struct Readback {
+        unsigned int buffer = 0;
+        GLsync fence = nullptr;
+        uint64_t frame = 0;
+    };
+
+    int pagesAcross;
+    int feedbackDivisor;
+    unsigned int physical = 0;
+    std::vector<Page> pages;
+    std::vector<std::unique_ptr<VirtualTexture>> textures;
+    std::vector<Request> wanted;
+    uint64_t frame = 0;
+
+    unsigned int feedbackFramebuffer = 0;
+    unsigned int feedbackColor = 0;
+    unsigned int feedbackDepth = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    GLint savedViewport[4] = {};
+    Readback readbacks[3];
+    uint64_t feedbackFrames = 0;
+
+    static uint64_t tileKey(int level, int x, int y)
+    {
+        return (uint64_t)level << 48 | (uint64_t)(uint32_t)y << 24 | (uint64_t)(uint32_t)x;
+    }
+
+    void resizeFeedback(int width, int height)
+    {
+        feedbackWidth = width;
+        feedbackHeight = height;
+        if (feedbackFramebuffer == 0)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(1, &feedbackColor);
+            glGenRenderbuffers(1, &feedbackDepth);
+            for (Readback& readback : readbacks)
+                glGenBuffers(1, &readback.buffer);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // readbacks still in flight were sized for the old framebuffer
+        for (Readback& readback : readbacks)
+        {
+            if (readback.fence != nullptr)
+                glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+            GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(width) * height * 8, NULL, GL_STREAM_READ);
+        }
+        GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // turns one feedback image into tile requests; tiles already resident just count as used this frame
+    void collectRequests(const Readback& readback)
+    {
+        size_t size = static_cast<size_t>(feedbackWidth) * feedbackHeight * 8;
+        GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const uint16_t* texels = static_cast<const uint16_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+        if (texels != nullptr)
+        {
+            std::unordered_set<uint64_t> seen;
+            for (size_t i = 0; i < size / 8; i++, texels += 4)
+            {
+                int id = texels[3];
+                if (id >= (int)textures.size())
+                    continue;
+                VirtualTexture& texture = *textures[id];
+                int level = std::min<int>(texels[2], texture.header.levelCount - 1);
+                int x = std::min<int>(texels[0], texture.TilesX(level) - 1);
+                int y = std::min<int>(texels[1], texture.TilesY(level) - 1);
+                uint64_t key = tileKey(level, x, y);
+                if (!seen.insert(key ^ (uint64_t)id << 56).second)
+                    continue;
+                auto resident = texture.resident.find(key);
+                if (resident != texture.resident.end())
+                    pages[resident->second].lastUsed = frame;
+                else
+                    wanted.push_back({ id, level, x, y });
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        GLState().BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // copies a tile from its file into a free page, or the least recently used one not needed this frame
+    bool pageIn(int id, int level, int x, int y, bool pinned)
+    {
+        int slot = -1;
+        for (int i = 0; i < (int)pages.size(); i++)
+        {
+            const Page& page = pages[i];
+            if (page.texture < 0)
+            {
+                slot = i;
+                break;
+            }
+            if (!page.pinned && page.lastUsed < frame && (slot < 0 || page.lastUsed < pages[slot].lastUsed))
+                slot = i;
+        }
+        if (slot < 0)
+            return false;
+
+        Page& page = pages[slot];
+        if (page.texture >= 0)
+        {
+            VirtualTexture& evicted = *textures[page.texture];
+            evicted.resident.erase(tileKey(page.level, page.x, page.y));
+            evicted.dirty = true;
+        }
+        VirtualTexture& texture = *textures[id];
+        const unsigned char* tile = texture.file.Data() + texture.header.levelOffsets[level] +
+                                    (static_cast<size_t>(y) * texture.TilesX(level) + x) * VT_PAGE_BYTES;
+        GLState().BindTexture(GL_TEXTURE_2D, physical);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % pagesAcross) * VT_PAGE_SIZE, (slot / pagesAcross) * VT_PAGE_SIZE,
+                        VT_PAGE_SIZE, VT_PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, tile);
+
+        page = { id, level, x, y, frame, pinned };
+        texture.resident[tileKey(level, x, y)] = slot;
+        texture.dirty = true;
+        return true;
+    }
+
+    // rebuilds the indirection texture: every tile points at its own page if resident, otherwise at whatever its
+    // parent tile points at, down to the pinned single-tile level
+    void updateIndirection(VirtualTexture& texture)
+    {
+        const unsigned char* pinned = nullptr;
+        unsigned char pinnedEntry[4];
+        auto pinnedPage = texture.resident.find(tileKey(texture.pinnedLevel, 0, 0));
+        if (pinnedPage != texture.resident.end())
+        {
+            pinnedEntry[0] = (unsigned char)(pinnedPage->second % pagesAcross);
+            pinnedEntry[1] = (unsigned char)(pinnedPage->second / pagesAcross);
+            pinnedEntry[2] = (unsigned char)texture.pinnedLevel;
+            pinnedEntry[3] = 1;
+            pinned = pinnedEntry;
+        }
+
+        GLState().BindTexture(GL_TEXTURE_2D_ARRAY, texture.indirection);
+        for (int level = (int)texture.header.levelCount - 1; level >= 0; level--)
+        {
+            std::vector<unsigned char>& table = texture.tables[level];
+            int tilesX = texture.TilesX(level);
+            int tilesY = texture.TilesY(level);
+            for (int y = 0; y < tilesY; y++)
+            {
+                for (int x = 0; x < tilesX; x++)
+                {
+                    unsigned char* entry = &table[(static_cast<size_t>(y) * tilesX + x) * 4];
+                    auto page = texture.resident.find(tileKey(level, x, y));
+                    if (page != texture.resident.end())
+                    {
+                        entry[0] = (unsigned char)(page->second % pagesAcross);
+                        entry[1] = (unsigned char)(page->second / pagesAcross);
+                        entry[2] = (unsigned char)level;
+                        entry[3] = 1;
+                    }
+                    else if (level >= texture.pinnedLevel)
+                        std::memcpy(entry, pinned, 4);
+                    else
+                    {
+                        // odd level sizes can leave the last tile without a parent of its own
+                        int parentX = std::min(x / 2, texture.TilesX(level + 1) - 1);
+                        int parentY = std::min(y / 2, texture.TilesY(level + 1) - 1);
+                        std::memcpy(entry, &texture.tables[level + 1][(static_cast<size_t>(parentY) * texture.TilesX(level + 1) + parentX) * 4], 4);
+                    }
+                }
+            }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, level, tilesX, tilesY, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, table.data());
+        }
+        texture.dirty = false;
+    }
+};
+#endif
@@ -0,0 +1,139 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of persistent threads for data parallel loops, e.g. decoding one large image over all cores.
+// ParallelFor splits [0, count) into chunks that the workers and the calling thread claim from a shared counter,
+// so the caller always makes progress itself and a ParallelFor issued from inside another one can't deadlock.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1)
+    {
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // calls body(begin, end) over disjoint ranges covering [0, count) and returns once all of them have finished
+    void ParallelFor(int count, const std::function<void(int, int)>& body)
+    {
+        if (count <= 0)
+            return;
+        if (workers.empty() || count == 1)
+        {
+            body(0, count);
+            return;
+        }
+
+        // a few chunks per thread keeps everyone busy when some ranges take longer than others
+        auto job = std::make_shared<Job>();
+        job->body = &body;
+        job->count = count;
+        job->chunk = std::max(1, count / (int)((workers.size() + 1) * 4));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        workAvailable.notify_all();
+
+        runChunks(*job);
+
+        // the job may still be queued if no worker picked it up before we finished every chunk
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = std::find(jobs.begin(), jobs.end(), job);
+            if (it != jobs.end())
+                jobs.erase(it);
+        }
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&] { return job->done == job->count; });
+    }
+
+    // number of threads that work on a ParallelFor, including the caller
+    unsigned int ThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+private:
+    struct Job {
+        const std::function<void(int, int)>* body = nullptr;
+        int count = 0;
+        int chunk = 1;
+        std::atomic<int> next{ 0 };
+        int done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    static void runChunks(Job& job)
+    {
+        for (;;)
+        {
+            int begin = job.next.fetch_add(job.chunk);
+            if (begin >= job.count)
+                return;
+            int end = std::min(job.count, begin + job.chunk);
+            (*job.body)(begin, end);
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.done += end - begin;
+            if (job.done == job.count)
+                job.finished.notify_all();
+        }
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = jobs.front();
+                // once every chunk has been claimed nobody else needs to see this job
+                if (job->next.load() >= job->count)
+                {
+                    jobs.pop_front();
+                    continue;
+                }
+            }
+            runChunks(*job);
+        }
+    }
+};
+
+// process-wide pool shared by everything that wants to spread a loop over the cores
+inline WorkerPool& SharedWorkerPool()
+{
+    static WorkerPool pool;
+    return pool;
+}
+#endif
@@ -4,21 +4,28 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef INSTANCED
+layout (location = 7) in mat4 aInstanceModel;  // Model::DrawInstanced's per-instance transform (INSTANCE_MODEL_LOCATION)
+layout (location = 11) in mat3 aInstanceNormal; // and its normal matrix (INSTANCE_NORMAL_LOCATION)
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniform_blocks.glsl"
 
 void main()
 {
+#ifdef INSTANCED
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    Normal = aInstanceNormal * aNormal;
+#else
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    Normal = mat3(normalMatrix) * aNormal;
+#endif
     TexCoords = aTexCoords;
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
 }
 
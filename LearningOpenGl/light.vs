@@ -2,13 +2,18 @@
 
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 7) in mat4 aInstanceModel;  // Model::DrawInstanced's per-instance transform (INSTANCE_MODEL_LOCATION)
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniform_blocks.glsl"
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef INSTANCED
+	gl_Position = viewProjection * (aInstanceModel * vec4(aPos, 1.0));
+#else
+	gl_Position = viewProjection * (model * vec4(aPos, 1.0));
+#endif
 }
 
@@ -0,0 +1,147 @@
+// Lighting shared by the lit fragment shaders: the light and material types, the Lights block (mirrored by
+// LightingUniforms.h) and the per-light shading functions. The including stage declares TexCoords first.
+
+struct Material {
+#ifndef TEXTURE_ARRAYS
+    sampler2D diffuse;
+    sampler2D specular;
+#endif
+    float shininess;
+}; 
+
+struct DirLight {
+    vec3 direction;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    
+    float constant;
+    float linear;
+    float quadratic;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+  
+    float constant;
+    float linear;
+    float quadratic;
+  
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;       
+};
+
+#define NR_POINT_LIGHTS 4
+
+// Permutation switches, injected by Shader as #defines (see ShaderVariants.h) so each variant only does the work its
+// draws need:
+//   POINT_LIGHT_COUNT  how many of pointLights are lit (default all); the block keeps its size so its layout never changes
+//   NO_DIR_LIGHT       skip the directional light
+//   NO_SPOTLIGHT       skip the flashlight
+//   NO_SPECULAR_MAP    the material has no specular map, so there are no specular highlights at all
+//   TEXTURE_ARRAYS     the maps are layers of texture arrays (TextureLoadOptions::packTextureArrays): a model's
+//                      texture_diffuse1 and texture_specular1 with their _layer, instead of material.diffuse/specular
+#ifndef POINT_LIGHT_COUNT
+#define POINT_LIGHT_COUNT NR_POINT_LIGHTS
+#endif
+#ifdef TEXTURE_ARRAYS
+uniform sampler2DArray texture_diffuse1;
+uniform int texture_diffuse1_layer;
+#define DIFFUSE_MAP vec3(texture(texture_diffuse1, vec3(TexCoords, texture_diffuse1_layer)))
+#else
+#define DIFFUSE_MAP vec3(texture(material.diffuse, TexCoords))
+#endif
+#if defined(NO_SPECULAR_MAP)
+#define SPECULAR_MAP vec3(0.0)
+#elif defined(TEXTURE_ARRAYS)
+uniform sampler2DArray texture_specular1;
+uniform int texture_specular1_layer;
+#define SPECULAR_MAP vec3(texture(texture_specular1, vec3(TexCoords, texture_specular1_layer)))
+#else
+#define SPECULAR_MAP vec3(texture(material.specular, TexCoords))
+#endif
+
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
+uniform Material material;
+
+// calculates the color when using a directional light.
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    // combine results
+    vec3 ambient = light.ambient * DIFFUSE_MAP;
+    vec3 diffuse = light.diffuse * diff * DIFFUSE_MAP;
+    vec3 specular = light.specular * spec * SPECULAR_MAP;
+    return (ambient + diffuse + specular);
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // combine results
+    vec3 ambient = light.ambient * DIFFUSE_MAP;
+    vec3 diffuse = light.diffuse * diff * DIFFUSE_MAP;
+    vec3 specular = light.specular * spec * SPECULAR_MAP;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction)); 
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * DIFFUSE_MAP;
+    vec3 diffuse = light.diffuse * diff * DIFFUSE_MAP;
+    vec3 specular = light.specular * spec * SPECULAR_MAP;
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    return (ambient + diffuse + specular);
+}
+
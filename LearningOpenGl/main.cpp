@@ -10,6 +10,11 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "GLLoaderThread.h"
+#include "LightingUniforms.h"
+#include "UniformBlocks.h"
+#include "ShaderCompileQueue.h"
+#include "ShaderHotReload.h"
 
 #include <iostream>
 #include <filesystem>
@@ -71,8 +76,12 @@ int main()
         return -1;
     }
 
+    // stream texture and buffer contents to the GPU over the first frames instead of stalling while loading
+    auto uploadStream = std::make_unique<UploadStream>();
+    activeUploadStream = uploadStream.get();
+
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
-    stbi_set_flip_vertically_on_load(true);
+    textureLoadOptions.decode.flipVertically = true;
 
     // configure global opengl state
     // -----------------------------
@@ -80,20 +89,51 @@ int main()
 
     // build and compile shaders
     // -------------------------
-    Shader ourShader("1.model_loading.vs", "1.model_loading.fs");
+    // the model shader builds in the background; until it is ready the model is drawn with the plain light shader.
+    // Camera and object transforms go to every program through the shared uniform blocks; programs that still declare
+    // them as plain uniforms get them through handles resolved once they have linked.
+    // Both programs are rebuilt whenever one of their files is saved, so shaders can be edited without a restart.
+    ShaderCompileQueue shaderQueue;
+    ShaderHotReload shaderReload(shaderQueue);
+    TransformUniforms transform;
+    auto prepareModelShader = [&](Shader& shader) {
+        transform.Resolve(shader);
+        ValidateStd140Block<FrameBlock>(shader.ID, "Frame");
+        ValidateStd140Block<ObjectBlock>(shader.ID, "Object");
+    };
+    std::shared_ptr<Shader> ourShader = shaderQueue.Add("1.model_loading.vs", "1.model_loading.fs", nullptr, prepareModelShader,
+                                                        TextureShaderDefines());
+    auto fallbackShader = std::make_shared<Shader>("light.vs", "light.fs");
+    shaderReload.Watch(ourShader, prepareModelShader);
+    shaderReload.Watch(fallbackShader);
 
     // load models
     // -----------
     std::string s("someString");
 
-    Model ourModel(s);
+    // the model loads on a second context sharing objects with the window, so the render loop runs meanwhile
+    std::unique_ptr<GLLoaderThread> loader = CreateLoaderThread(window);
+    Model ourModel;
+    bool modelReady = false;
+    if (loader)
+        loader->Enqueue([&, options = textureLoadOptions] { ourModel.Load(s, options); }, [&] { modelReady = true; });
+    else
+    {
+        ourModel.Load(s);
+        modelReady = true;
+    }
 
 
     // draw in wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+    auto frameUniforms = std::make_unique<FrameUniforms>();
+    auto objectUniforms = std::make_unique<ObjectUniforms>();
+    RenderQueue renderQueue;
+
     // render loop
     // -----------
+    float lastStateReport = 0.0f;
     while (!glfwWindowShouldClose(window))
     {
         // per-frame time logic
@@ -101,32 +141,60 @@ int main()
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        GLState().BeginFrame();
 
         // input
         // -----
         processInput(window);
 
+        // hand this frame's share of pending uploads to the GPU
+        uploadStream->Update();
+        // pick up whatever the loader thread finished
+        if (loader)
+            loader->Poll();
+        // and whatever programs the driver finished building
+        shaderQueue.Poll();
+        // and swap in programs rebuilt because their sources changed
+        shaderReload.Update();
+
         // render
         // ------
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // don't forget to enable shader before setting uniforms
-        ourShader.use();
+        Shader& shader = UsableShader(ourShader, *fallbackShader);
+        shader.use();
 
         // view/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
+        frameUniforms->Update(view, projection, camera.Position);
+        objectUniforms->BeginFrame();
+        shader.set(transform.projection, projection);
+        shader.set(transform.view, view);
 
-        // render the loaded model
+        // render the loaded model: its meshes go through the render queue, which draws them in state order
+        renderQueue.Begin(view, 100.0f);
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
-        ourShader.setMat4("model", model);
-        ourModel.Draw(ourShader);
-
+        if (modelReady)
+            ourModel.Submit(renderQueue, shader, model);
+        renderQueue.Flush([&](Shader& program, const glm::mat4& objectModel) {
+            objectUniforms->Bind(objectModel);
+            program.set(transform.model, objectModel);
+        });
+
+        // once a second, show how many of the frame's binds and state changes the state cache kept from reaching GL
+        if (currentFrame - lastStateReport >= 1.0f)
+        {
+            GLStateStats stats = GLState().FrameStats();
+            std::string title = "LearnOpenGL - GL state calls: " + std::to_string(stats.issued) + " issued, " +
+                                std::to_string(stats.skipped) + " skipped";
+            glfwSetWindowTitle(window, title.c_str());
+            lastStateReport = currentFrame;
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -134,6 +202,13 @@ int main()
         glfwPollEvents();
     }
 
+    // the loader and the staging ring have to go while their contexts are still alive
+    loader.reset();
+    activeUploadStream = nullptr;
+    uploadStream.reset();
+    frameUniforms.reset();
+    objectUniforms.reset();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -9,12 +9,18 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "UploadStream.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
+// first of the four vertex attributes (one per column) the per-instance model matrix of DrawInstanced arrives in
+#define INSTANCE_MODEL_LOCATION 7
+// and of the three its normal matrix arrives in
+#define INSTANCE_NORMAL_LOCATION 11
 
 struct Vertex {
     // position
@@ -33,10 +39,37 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// what DrawInstanced reads per instance. The normal matrix is worked out once per instance on the CPU rather than
+// once per vertex in the shader.
+struct InstanceData {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+};
+
+enum TextureType {
+    TEXTURE_DIFFUSE,
+    TEXTURE_SPECULAR,
+    TEXTURE_NORMAL,
+    TEXTURE_HEIGHT
+};
+
+// the sampler name prefix shaders use for a texture type: texture_diffuseN, texture_specularN, ...
+inline const char* TextureTypeName(TextureType type)
+{
+    switch (type)
+    {
+    case TEXTURE_DIFFUSE: return "texture_diffuse";
+    case TEXTURE_SPECULAR: return "texture_specular";
+    case TEXTURE_NORMAL: return "texture_normal";
+    default: return "texture_height";
+    }
+}
+
 struct Texture {
     unsigned int id;
-    string type;
+    TextureType type;
     string path;
+    int layer = -1;     // layer within the GL_TEXTURE_2D_ARRAY id names, or -1 for a plain GL_TEXTURE_2D
 };
 
 class Mesh {
@@ -45,7 +78,9 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    glm::vec3            center = glm::vec3(0.0f);  // of the bounding box, in model space; RenderQueue sorts by it
+    unsigned int VAO = 0;   // created on first draw: vertex arrays aren't shared between contexts
+    unsigned int instancedVAO = 0;  // the same plus the instance attributes, created on the first DrawInstanced
 
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
@@ -53,71 +88,180 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        if (!vertices.empty())
+        {
+            glm::vec3 lower = vertices[0].Position, upper = vertices[0].Position;
+            for (const Vertex& vertex : vertices)
+            {
+                lower = glm::min(lower, vertex.Position);
+                upper = glm::max(upper, vertex.Position);
+            }
+            center = (lower + upper) * 0.5f;
+        }
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader& shader)
+    // render the mesh. boundArrays are texture arrays the caller already bound to units 0, 1, ...; textures packed
+    // into one of them only get their sampler and layer set.
+    void Draw(Shader& shader, const vector<unsigned int>& boundArrays = {})
     {
-        // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
+        // buffers streamed through an UploadStream can't be drawn before their contents went out
+        if (activeUploadStream != nullptr && !activeUploadStream->IsSubmitted(uploadTicket))
+            return;
+
+        bindTextures(shader, boundArrays);
 
         // draw mesh
-        glBindVertexArray(VAO);
+        if (VAO == 0)
+            VAO = createVertexArray();
+        // the vertex array stays bound: a model's meshes are often drawn again right away, e.g. in the next frame
+        GLState().BindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    }
+
+    // renders count copies of the mesh in one draw. instanceBuffer holds an InstanceData per instance, read through
+    // attributes INSTANCE_MODEL_LOCATION.. and INSTANCE_NORMAL_LOCATION.. (see the INSTANCED path of colors.vs).
+    void DrawInstanced(Shader& shader, const vector<unsigned int>& boundArrays, unsigned int instanceBuffer, GLsizei count)
+    {
+        if (activeUploadStream != nullptr && !activeUploadStream->IsSubmitted(uploadTicket))
+            return;
+
+        bindTextures(shader, boundArrays);
+
+        // a vertex array of its own, so the instance attributes (which advance per instance) never stay enabled for
+        // a plain Draw
+        if (instancedVAO == 0)
+            instancedVAO = createVertexArray();
+        GLState().BindVertexArray(instancedVAO);
+        if (instanceAttributesBuffer != instanceBuffer)
+            setupInstanceAttributes(instanceBuffer);
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, count);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // call when the instance buffer last drawn with is deleted: GL may hand its name out again, and a new buffer under
+    // the same name still needs the attributes pointed at it
+    void ForgetInstanceBuffer()
+    {
+        instanceAttributesBuffer = 0;
     }
 
 private:
+    // binds our textures for shader and points its samplers at them
+    void bindTextures(Shader& shader, const vector<unsigned int>& boundArrays)
+    {
+        const vector<SamplerBinding>& bindings = samplerBindingsFor(shader);
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            // our own units come after the ones holding boundArrays
+            unsigned int unit = static_cast<unsigned int>(boundArrays.size()) + i;
+            if (textures[i].layer >= 0)
+            {
+                // a layer of a texture array: point the sampler at the array's unit and tell the shader which layer
+                auto bound = std::find(boundArrays.begin(), boundArrays.end(), textures[i].id);
+                if (bound != boundArrays.end())
+                    unit = static_cast<unsigned int>(bound - boundArrays.begin());
+                else
+                    GLState().BindTexture(unit, GL_TEXTURE_2D_ARRAY, textures[i].id);
+                shader.set(bindings[i].sampler, (int)unit);
+                shader.set(bindings[i].layer, textures[i].layer);
+                continue;
+            }
+
+            // set the sampler to the texture's unit (a no-op once the program has that unit)
+            shader.set(bindings[i].sampler, (int)unit);
+            // and bind the texture there, unless it still is from the last draw
+            GLState().BindTexture(unit, GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // the uniforms one of our textures is set through: texture_diffuseN and, for a texture array layer, its _layer
+    struct SamplerBinding {
+        UniformHandle<int> sampler;
+        UniformHandle<int> layer;
+    };
+    // the bindings of every texture, per program we have been drawn with
+    struct ProgramBindings {
+        uint64_t program;   // Shader::serial()
+        vector<SamplerBinding> bindings;
+    };
+
     // render data 
     unsigned int VBO, EBO;
+    uint64_t uploadTicket = 0;  // last upload of our buffers queued on activeUploadStream
+    unsigned int instanceAttributesBuffer = 0;  // the instance buffer our vertex array reads model matrices from
+    vector<ProgramBindings> samplerBindings;
+
+    // resolves the sampler uniforms of our textures in shader the first time we are drawn with it; afterwards the
+    // draw only has to look up the program's entry
+    const vector<SamplerBinding>& samplerBindingsFor(const Shader& shader)
+    {
+        for (const ProgramBindings& known : samplerBindings)
+            if (known.program == shader.serial())
+                return known.bindings;
 
-    // initializes all the buffer objects/arrays
+        ProgramBindings resolved{ shader.serial(), {} };
+        unsigned int numbers[TEXTURE_HEIGHT + 1] = {};
+        for (const Texture& texture : textures)
+        {
+            // the N in texture_diffuseN counts the textures of each type from 1
+            string name = TextureTypeName(texture.type) + std::to_string(++numbers[texture.type]);
+            SamplerBinding binding;
+            binding.sampler = shader.uniform<int>(name);
+            if (texture.layer >= 0)
+                binding.layer = shader.uniform<int>(name + "_layer");
+            resolved.bindings.push_back(binding);
+        }
+        samplerBindings.push_back(std::move(resolved));
+        return samplerBindings.back().bindings;
+    }
+
+    // creates the buffer objects and loads the mesh data into them. This may run on a loader thread's context, so
+    // the vertex array (which isn't shared between contexts) is left to createVertexArray.
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
+        // create buffers
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        // Element buffers are bound through GL_COPY_WRITE_BUFFER here since GL_ELEMENT_ARRAY_BUFFER needs a vertex array.
+        size_t vertexBytes = vertices.size() * sizeof(Vertex);
+        size_t indexBytes = indices.size() * sizeof(unsigned int);
+        if (activeUploadStream != nullptr)
+        {
+            // only allocate the storage here; the upload stream copies the contents in over the next frames
+            GLState().BindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+            GLState().BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+            glBufferData(GL_COPY_WRITE_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+            activeUploadStream->QueueBuffer(VBO, 0, vertexBytes, [data = vertices, vertexBytes](unsigned char* dst) {
+                std::memcpy(dst, data.data(), vertexBytes);
+            });
+            uploadTicket = activeUploadStream->QueueBuffer(EBO, 0, indexBytes, [data = indices, indexBytes](unsigned char* dst) {
+                std::memcpy(dst, data.data(), indexBytes);
+            });
+        }
+        else
+        {
+            GLState().BindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexBytes, &vertices[0], GL_STATIC_DRAW);
+            GLState().BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+            glBufferData(GL_COPY_WRITE_BUFFER, indexBytes, &indices[0], GL_STATIC_DRAW);
+        }
+    }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    // creates a vertex array over our buffers, on the context that draws it
+    unsigned int createVertexArray()
+    {
+        unsigned int vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        GLState().BindVertexArray(vertexArray);
+        GLState().BindBuffer(GL_ARRAY_BUFFER, VBO);
+        GLState().BindElementBuffer(EBO);
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -142,7 +286,29 @@ private:
         // weights
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        return vertexArray;
+    }
+
+    // points the instance attributes of our (bound) instanced vertex array at instanceBuffer: a matrix takes one attribute per
+    // column, each advancing once per instance instead of per vertex
+    void setupInstanceAttributes(unsigned int instanceBuffer)
+    {
+        GLState().BindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+            glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (void*)(offsetof(InstanceData, model) + sizeof(glm::vec4) * column));
+            glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + column, 1);
+        }
+        for (GLuint column = 0; column < 3; column++)
+        {
+            glEnableVertexAttribArray(INSTANCE_NORMAL_LOCATION + column);
+            glVertexAttribPointer(INSTANCE_NORMAL_LOCATION + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (void*)(offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * column));
+            glVertexAttribDivisor(INSTANCE_NORMAL_LOCATION + column, 1);
+        }
+        instanceAttributesBuffer = instanceBuffer;
     }
 };
 #endif
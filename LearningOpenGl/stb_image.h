@@ -258,14 +258,16 @@ RECENT REVISION HISTORY:
 // SIMD support
 //
 // The JPEG decoder will try to automatically use SIMD kernels on x86 when
-// supported by the compiler. For ARM Neon support, you must explicitly
-// request it.
+// supported by the compiler, as will the PNG scanline unfiltering (x86 SSE2
+// only). For ARM Neon support, you must explicitly request it.
 //
 // (The old do-it-yourself SIMD API is no longer supported in the current
 // code.)
 //
 // On x86, SSE2 will automatically be used when available based on a run-time
-// test; if not, the generic C versions are used as a fall-back. On ARM targets,
+// test; if not, the generic C versions are used as a fall-back. The JPEG
+// kernels also have AVX2 versions that are likewise picked at run time (define
+// STBI_NO_AVX2 to leave them out). On ARM targets,
 // the typical path is to have separate builds for NEON and non-NEON devices
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
@@ -524,6 +526,32 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// stb_image has no threads of its own, but it can split the work of decoding one
+// large image (JPEG IDCT, upsampling and color conversion; PNG unfiltering, which
+// runs alongside the inflate of the rows after it; format conversion and flipping
+// for every format) across yours. The parallel-for must call
+// task(context, begin, end) over disjoint ranges that together cover [0,count),
+// from any threads, and return only once all of them are done. Images with fewer
+// than min_pixels pixels (0 = default of 1M) are decoded on the calling thread.
+// Pass NULL to turn it off again.
+typedef void stbi_parallel_task(void *context, int begin, int end);
+typedef void stbi_parallel_for(void *user, stbi_parallel_task *task, void *context, int count);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user, int min_pixels);
+// as above, but only for images loaded on the calling thread (needs thread-local support, like the _thread functions above)
+STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for *parallel_for, void *user, int min_pixels);
+
+// caps the SIMD kernels the JPEG decoder picks for images loaded from now on,
+// e.g. to compare them against each other; process-wide. The default is
+// STBI_SIMD_AVX2, i.e. the best the CPU has. Returns the level actually used,
+// which is lower than limit where the CPU (or this build) lacks it.
+enum
+{
+   STBI_SIMD_NONE     = 0, // the C kernels
+   STBI_SIMD_BASELINE = 1, // SSE2 or NEON
+   STBI_SIMD_AVX2     = 2
+};
+STBIDEF int stbi_set_jpeg_simd_limit(int limit);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -643,12 +671,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -750,7 +780,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -761,7 +791,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -774,6 +804,59 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// x86 AVX2: the JPEG IDCT, color conversion and upsampling kernels have AVX2
+// versions that are picked at run time when the CPU and OS support them, on
+// top of the SSE2 baseline. They are compiled with a per-function target
+// attribute, so no -mavx2 is needed. Define STBI_NO_AVX2 to leave them out.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG)
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#define STBI_AVX2
+#define STBI__AVX2_TARGET
+#elif defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define STBI_AVX2
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef STBI_AVX2
+#include <immintrin.h>
+
+static int stbi__avx2_available(void)
+{
+   unsigned int ecx1, ebx7, xcr0;
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7) return 0;
+   __cpuid(info, 1);
+   ecx1 = (unsigned int) info[2];
+   __cpuidex(info, 7, 0);
+   ebx7 = (unsigned int) info[1];
+#else
+   unsigned int a,b,c,d;
+   if (__get_cpuid_max(0, 0) < 7) return 0;
+   __cpuid(1, a, b, c, d);
+   ecx1 = c;
+   __cpuid_count(7, 0, a, b, c, d);
+   ebx7 = b;
+#endif
+   // the CPU must have AVX (and OSXSAVE), and the OS must save the ymm registers
+   if ((ecx1 & ((1u << 27) | (1u << 28))) != ((1u << 27) | (1u << 28))) return 0;
+#ifdef _MSC_VER
+   xcr0 = (unsigned int) _xgetbv(0);
+#else
+   {
+      unsigned int xcr0_hi;
+      __asm__ __volatile__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+      (void) xcr0_hi;
+   }
+#endif
+   if ((xcr0 & 6) != 6) return 0;
+   return (ebx7 >> 5) & 1;
+}
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1134,6 +1217,104 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+typedef struct
+{
+   stbi_parallel_for *fn;
+   void *user;
+   int min_pixels;
+} stbi__parallel_for_settings;
+
+static stbi__parallel_for_settings stbi__parallel_for_global = { NULL, NULL, 1 << 20 };
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user, int min_pixels)
+{
+   stbi__parallel_for_global.fn = parallel_for;
+   stbi__parallel_for_global.user = user;
+   stbi__parallel_for_global.min_pixels = min_pixels > 0 ? min_pixels : 1 << 20;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__parallel_for_current  stbi__parallel_for_global
+#else
+static STBI_THREAD_LOCAL stbi__parallel_for_settings stbi__parallel_for_local;
+static STBI_THREAD_LOCAL int stbi__parallel_for_set;
+
+STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for *parallel_for, void *user, int min_pixels)
+{
+   stbi__parallel_for_local.fn = parallel_for;
+   stbi__parallel_for_local.user = user;
+   stbi__parallel_for_local.min_pixels = min_pixels > 0 ? min_pixels : 1 << 20;
+   stbi__parallel_for_set = 1;
+}
+
+#define stbi__parallel_for_current  (stbi__parallel_for_set                 \
+                                      ? stbi__parallel_for_local            \
+                                      : stbi__parallel_for_global)
+#endif // STBI_THREAD_LOCAL
+
+static int stbi__jpeg_simd_limit = STBI_SIMD_AVX2;
+
+STBIDEF int stbi_set_jpeg_simd_limit(int limit)
+{
+   int level = STBI_SIMD_NONE;
+   stbi__jpeg_simd_limit = limit;
+#if defined(STBI_SSE2) && !defined(STBI_NO_JPEG)
+   if (limit >= STBI_SIMD_BASELINE && stbi__sse2_available()) level = STBI_SIMD_BASELINE;
+#endif
+#ifdef STBI_NEON
+   if (limit >= STBI_SIMD_BASELINE) level = STBI_SIMD_BASELINE;
+#endif
+#ifdef STBI_AVX2
+   if (limit >= STBI_SIMD_AVX2 && stbi__avx2_available()) level = STBI_SIMD_AVX2;
+#endif
+   return level;
+}
+
+#define stbi__parallel_for_fn          (stbi__parallel_for_current.fn)
+#define stbi__parallel_for_user        (stbi__parallel_for_current.user)
+#define stbi__parallel_min_pixels      (stbi__parallel_for_current.min_pixels)
+
+// whether a w*h image is worth splitting across the parallel-for
+static int stbi__parallel_ok(int w, int h)
+{
+   return stbi__parallel_for_fn != NULL && (double) w * h >= stbi__parallel_min_pixels;
+}
+
+// runs task over [0,count), through the parallel-for if parallel is set and inline otherwise.
+// tasks must not call stbi__err; they report failure through their context instead
+static void stbi__parallel_run(int parallel, stbi_parallel_task *task, void *context, int count)
+{
+   if (count <= 0) return;
+   if (parallel && count > 1)
+      stbi__parallel_for_fn(stbi__parallel_for_user, task, context, count);
+   else
+      task(context, 0, count);
+}
+
+// rows per work item for the row-parallel passes
+#define STBI__PARALLEL_ROWS 16
+
+// the PNG decoder overlaps inflate with unfiltering, which needs a counter that one
+// task publishes and another polls; without compiler atomics that step stays serial
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define stbi__atomic_load(p)        _InterlockedOr((volatile long *) (p), 0)
+#define stbi__atomic_store(p,v)     _InterlockedExchange((volatile long *) (p), (v))
+#define stbi__atomic_increment(p)   _InterlockedIncrement((volatile long *) (p))
+#elif defined(__GNUC__) || defined(__clang__)
+#define stbi__atomic_load(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define stbi__atomic_store(p,v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define stbi__atomic_increment(p)   __atomic_add_fetch((p), 1, __ATOMIC_ACQ_REL)
+#else
+#define STBI__NO_ATOMICS
+#endif
+
+#ifdef STBI_SSE2
+#define stbi__spin_pause()  _mm_pause()
+#else
+#define stbi__spin_pause()  ((void) 0)
+#endif
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1219,16 +1400,26 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    return enlarged;
 }
 
-static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
+typedef struct
+{
+   stbi_uc *bytes;
+   size_t bytes_per_row;
+   int h;
+} stbi__flip_job;
+
+// swaps the row pairs [begin,end) of a vertical flip, in items of STBI__PARALLEL_ROWS pairs
+static void stbi__vertical_flip_task(void *context, int begin, int end)
 {
-   int row;
-   size_t bytes_per_row = (size_t)w * bytes_per_pixel;
+   stbi__flip_job *job = (stbi__flip_job *) context;
+   int row, last = end * STBI__PARALLEL_ROWS;
+   size_t bytes_per_row = job->bytes_per_row;
    stbi_uc temp[2048];
-   stbi_uc *bytes = (stbi_uc *)image;
+   stbi_uc *bytes = job->bytes;
 
-   for (row = 0; row < (h>>1); row++) {
+   if (last > (job->h>>1)) last = job->h>>1;
+   for (row = begin * STBI__PARALLEL_ROWS; row < last; row++) {
       stbi_uc *row0 = bytes + row*bytes_per_row;
-      stbi_uc *row1 = bytes + (h - row - 1)*bytes_per_row;
+      stbi_uc *row1 = bytes + (job->h - row - 1)*bytes_per_row;
       // swap row0 with row1
       size_t bytes_left = bytes_per_row;
       while (bytes_left) {
@@ -1243,6 +1434,16 @@ static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
    }
 }
 
+static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
+{
+   stbi__flip_job job;
+   job.bytes = (stbi_uc *) image;
+   job.bytes_per_row = (size_t)w * bytes_per_pixel;
+   job.h = h;
+   stbi__parallel_run(stbi__parallel_ok(w, h), stbi__vertical_flip_task, &job,
+                      ((h>>1) + STBI__PARALLEL_ROWS-1) / STBI__PARALLEL_ROWS);
+}
+
 #ifndef STBI_NO_GIF
 static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
 {
@@ -1752,21 +1953,26 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+typedef struct
 {
-   int i,j;
-   unsigned char *good;
-
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+   unsigned char *data, *good;
+   int img_n, req_comp;
+   unsigned int x, y;
+   int failed;
+} stbi__convert_job;
 
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return stbi__errpuc("outofmem", "Out of memory");
-   }
+// converts the rows of items [begin,end), STBI__PARALLEL_ROWS rows per item
+static void stbi__convert_format_task(void *context, int begin, int end)
+{
+   stbi__convert_job *job = (stbi__convert_job *) context;
+   int i,j;
+   unsigned char *data = job->data, *good = job->good;
+   int img_n = job->img_n, req_comp = job->req_comp;
+   unsigned int x = job->x;
+   int last = end * STBI__PARALLEL_ROWS;
+   if (last > (int) job->y) last = (int) job->y;
 
-   for (j=0; j < (int) y; ++j) {
+   for (j=begin * STBI__PARALLEL_ROWS; j < last; ++j) {
       unsigned char *src  = data + j * x * img_n   ;
       unsigned char *dest = good + j * x * req_comp;
 
@@ -1787,10 +1993,40 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); job->failed = 1; return;
       }
       #undef STBI__CASE
    }
+}
+
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+   stbi__convert_job job;
+   unsigned char *good;
+
+   if (req_comp == img_n) return data;
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   if (good == NULL) {
+      STBI_FREE(data);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+
+   job.data = data;
+   job.good = good;
+   job.img_n = img_n;
+   job.req_comp = req_comp;
+   job.x = x;
+   job.y = y;
+   job.failed = 0;
+   stbi__parallel_run(stbi__parallel_ok((int) x, (int) y), stbi__convert_format_task, &job,
+                      (int) ((y + STBI__PARALLEL_ROWS-1) / STBI__PARALLEL_ROWS));
+   if (job.failed) {
+      STBI_FREE(data);
+      STBI_FREE(good);
+      return stbi__errpuc("unsupported", "Unsupported format conversion");
+   }
 
    STBI_FREE(data);
    return good;
@@ -1972,7 +2208,7 @@ typedef struct
       stbi_uc *data;
       void *raw_data, *raw_coeff;
       stbi_uc *linebuf;
-      short   *coeff;   // progressive only
+      short   *coeff;   // progressive, or one band of baseline blocks when idct_band is set
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
    } img_comp[4];
 
@@ -1982,6 +2218,7 @@ typedef struct
    int            nomore;      // flag if we saw a marker so must stop
 
    int            progressive;
+   int            idct_band;   // baseline: MCU rows collected per band and IDCT'd together in parallel, 0 = IDCT inline
    int            spec_start;
    int            spec_end;
    int            succ_high;
@@ -2704,6 +2941,171 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// AVX2 version of the sse2 IDCT above. Rows stay 8x16-bit, but every 32-bit
+// intermediate fits in one ymm register instead of a lo/hi pair of xmm, which
+// halves the multiply-accumulate and add work. Bit-identical to the other
+// versions.
+STBI__AVX2_TARGET
+static void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = _mm_load_si128((const __m128i *) (data + 0*8));
+   row1 = _mm_load_si128((const __m128i *) (data + 1*8));
+   row2 = _mm_load_si128((const __m128i *) (data + 2*8));
+   row3 = _mm_load_si128((const __m128i *) (data + 3*8));
+   row4 = _mm_load_si128((const __m128i *) (data + 4*8));
+   row5 = _mm_load_si128((const __m128i *) (data + 5*8));
+   row6 = _mm_load_si128((const __m128i *) (data + 6*8));
+   row7 = _mm_load_si128((const __m128i *) (data + 7*8));
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2946,6 +3348,78 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
+{
+   int i;
+   for (i=0; i < 64; ++i)
+      data[i] *= dequant[i];
+}
+
+// MCU rows per band of deferred baseline IDCT
+#define STBI__JPEG_IDCT_BAND 8
+
+// a batch of block rows to IDCT out of the coefficient buffers. Work items are block
+// rows, numbered through the components in order
+typedef struct
+{
+   stbi__jpeg *z;
+   int ncomp;
+   int comp[4];
+   int first_row[4], rows[4], cols[4];
+   int dequantize; // progressive coefficients are stored quantized, baseline ones are not
+} stbi__jpeg_idct_job;
+
+static void stbi__jpeg_idct_task(void *context, int begin, int end)
+{
+   stbi__jpeg_idct_job *job = (stbi__jpeg_idct_job *) context;
+   stbi__jpeg *z = job->z;
+   int item, i;
+   for (item = begin; item < end; ++item) {
+      int k = 0, r = item;
+      while (r >= job->rows[k]) r -= job->rows[k++];
+      {
+         int n = job->comp[k];
+         int row = job->first_row[k] + r;
+         short *data = z->img_comp[n].coeff + 64 * z->img_comp[n].coeff_w * (row % z->img_comp[n].coeff_h);
+         stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*row*8;
+         for (i=0; i < job->cols[k]; ++i, data += 64) {
+            if (job->dequantize)
+               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+            z->idct_block_kernel(out+i*8, z->img_comp[n].w2, data);
+         }
+      }
+   }
+}
+
+static void stbi__jpeg_idct_run(stbi__jpeg_idct_job *job)
+{
+   int k, count = 0;
+   for (k=0; k < job->ncomp; ++k)
+      count += job->rows[k];
+   stbi__parallel_run(stbi__parallel_ok(job->z->s->img_x, job->z->s->img_y), stbi__jpeg_idct_task, job, count);
+}
+
+// IDCTs the pending band of a baseline scan: MCU rows [first, end) of an interleaved scan, or
+// block rows [first, end) of a single-component one
+static int stbi__jpeg_flush_band(stbi__jpeg *z, int first, int end)
+{
+   stbi__jpeg_idct_job job;
+   int k;
+   job.z = z;
+   job.ncomp = z->scan_n;
+   job.dequantize = 0;
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      int rows_per = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+      job.comp[k] = n;
+      job.first_row[k] = first * rows_per;
+      job.rows[k] = (end - first) * rows_per;
+      job.cols[k] = z->scan_n == 1 ? (z->img_comp[n].x+7) >> 3 : z->img_mcu_x * z->img_comp[n].h;
+   }
+   stbi__jpeg_idct_run(&job);
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2960,24 +3434,32 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          // component has, independent of interleaved MCU blocking and such
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+         int band_first = 0;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               short *block = z->idct_band ? z->img_comp[n].coeff + 64 * (i + (j % z->img_comp[n].coeff_h) * z->img_comp[n].coeff_w) : data;
+               if (!stbi__jpeg_decode_block(z, block, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               if (!z->idct_band)
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
                   // if it's NOT a restart, then just bail, so we get corrupt data
                   // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
+                  if (!STBI__RESTART(z->marker)) return z->idct_band ? stbi__jpeg_flush_band(z, band_first, j+1) : 1;
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->idct_band && (j+1 - band_first == z->img_comp[n].coeff_h || j+1 == h)) {
+               stbi__jpeg_flush_band(z, band_first, j+1);
+               band_first = j+1;
+            }
          }
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
+         int band_first = 0;
          STBI_SIMD_ALIGN(short, data[64]);
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
@@ -2991,8 +3473,10 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int x2 = (i*z->img_comp[n].h + x)*8;
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        short *block = z->idct_band ? z->img_comp[n].coeff + 64 * (x2/8 + ((y2/8) % z->img_comp[n].coeff_h) * z->img_comp[n].coeff_w) : data;
+                        if (!stbi__jpeg_decode_block(z, block, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                        if (!z->idct_band)
+                           z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                      }
                   }
                }
@@ -3000,10 +3484,14 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                // so now count down the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
+                  if (!STBI__RESTART(z->marker)) return z->idct_band ? stbi__jpeg_flush_band(z, band_first, j+1) : 1;
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->idct_band && (j+1 - band_first == z->idct_band || j+1 == z->img_mcu_y)) {
+               stbi__jpeg_flush_band(z, band_first, j+1);
+               band_first = j+1;
+            }
          }
          return 1;
       }
@@ -3070,29 +3558,22 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    }
 }
 
-static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
-{
-   int i;
-   for (i=0; i < 64; ++i)
-      data[i] *= dequant[i];
-}
-
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
       // dequantize and idct the data
-      int i,j,n;
+      stbi__jpeg_idct_job job;
+      int n;
+      job.z = z;
+      job.ncomp = z->s->img_n;
+      job.dequantize = 1;
       for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
-         }
+         job.comp[n] = n;
+         job.first_row[n] = 0;
+         job.rows[n] = (z->img_comp[n].y+7) >> 3;
+         job.cols[n] = (z->img_comp[n].x+7) >> 3;
       }
+      stbi__jpeg_idct_run(&job);
    }
 }
 
@@ -3317,6 +3798,9 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
    // these sizes can't be more than 17 bits
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
+   // large baseline images keep their coefficients for a few MCU rows at a time, so the IDCT
+   // of each band can be spread over the parallel-for while entropy decoding stays serial
+   z->idct_band = (!z->progressive && stbi__parallel_ok(s->img_x, s->img_y)) ? STBI__JPEG_IDCT_BAND : 0;
 
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
@@ -3347,6 +3831,14 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+      } else if (z->idct_band) {
+         // room for one band of MCU rows; see stbi__parse_entropy_coded_data
+         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
+         z->img_comp[i].coeff_h = z->idct_band * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
+         if (z->img_comp[i].raw_coeff == NULL)
+            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+         z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
       }
    }
 
@@ -3643,6 +4135,86 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// same filter as stbi__resample_row_hv_2_simd, 16 input pixels at a time
+STBI__AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   // need to generate 2x2 samples for every one in input
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // process groups of 16 pixels for as long as we can.
+   // note we can't handle the last pixel in a row in this loop
+   // because we need to handle the filter boundary conditions.
+   for (; i < ((w-1) & ~15); i += 16) {
+      // load and perform the vertical filtering pass
+      // this uses 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff); // current row
+
+      // "prev" is current row shifted right by 1 pixel across both lanes,
+      // with the previous pixel value (from t1) inserted; "next" is current
+      // row shifted left by 1 pixel, with the first pixel of the next block.
+      __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+      __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, (short) t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, (short) (3*in_near[i+16] + in_far[i+16]), 15);
+
+      // horizontal filter, polyphase implementation since it's convenient:
+      // even pixels = 3*cur + prev = cur*4 + (prev - cur)
+      // odd  pixels = 3*cur + next = cur*4 + (next - cur)
+      // note the shared term.
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling. the unpacks work
+      // per 128-bit lane, so the pack puts pixels 0..7 in the low lane and
+      // 8..15 in the high lane, which is already output order.
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+
+      // pack and write output
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3817,6 +4389,97 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// same arithmetic as the sse2 path of stbi__YCbCr_to_RGB_simd, 16 pixels at a
+// time; whatever is left over goes through the sse2/scalar version. unlike the
+// sse2 path this also handles step == 3, which is what 3-channel loads (the
+// default for JPEG textures) go through.
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4 || step == 3) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      // drops the alpha byte of every pixel in a 128-bit lane, for step == 3
+      __m256i rgb_shuffle = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                             0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+      // the step == 3 stores write 4 bytes past the 16 pixels, so keep 2 more pixels in hand
+      int slack = step == 3 ? 2 : 0;
+
+      for (; i+15+slack < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr+i));
+         __m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb+i));
+         __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+         // widen to short in pixel order (y in the high byte over a bias of
+         // 128, cr/cb signed and left-shifted by 8), same values as the
+         // byte unpacks in the sse2 version
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(cr_biased), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(cb_biased), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels; each 128-bit lane ends up
+         // holding pixels 0..3/4..7 (low lane) and 8..11/12..15 (high lane)
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store
+         if (step == 4) {
+            _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+            out += 64;
+         } else {
+            // 12 useful bytes per group of 4 pixels; each store's 4 byte
+            // tail is overwritten by the next one
+            __m256i c0 = _mm256_shuffle_epi8(o0, rgb_shuffle);
+            __m256i c1 = _mm256_shuffle_epi8(o1, rgb_shuffle);
+            _mm_storeu_si128((__m128i *) (out + 0), _mm256_castsi256_si128(c0));
+            _mm_storeu_si128((__m128i *) (out + 12), _mm256_castsi256_si128(c1));
+            _mm_storeu_si128((__m128i *) (out + 24), _mm256_extracti128_si256(c0, 1));
+            _mm_storeu_si128((__m128i *) (out + 36), _mm256_extracti128_si256(c1, 1));
+            out += 48;
+         }
+      }
+   }
+
+   if (i < count)
+      stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
@@ -3825,17 +4488,27 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
-   if (stbi__sse2_available()) {
+   if (stbi__jpeg_simd_limit >= STBI_SIMD_BASELINE && stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__jpeg_simd_limit >= STBI_SIMD_AVX2 && stbi__avx2_available()) {
+      j->idct_block_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
-   j->idct_block_kernel = stbi__idct_simd;
-   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   if (stbi__jpeg_simd_limit >= STBI_SIMD_BASELINE) {
+      j->idct_block_kernel = stbi__idct_simd;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   }
 #endif
 }
 
@@ -3862,73 +4535,67 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+typedef struct
 {
+   stbi__jpeg *z;
+   stbi__resample res_comp[4]; // per-component resamplers, positioned at row 0
+   stbi_uc *output;
    int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
-   else
-      decode_n = z->s->img_n;
-
-   // nothing to do if no components requested; check this now to avoid
-   // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+   int failed;
+} stbi__jpeg_convert_job;
+
+// positions a resampler that starts at row 0 where it is after 'row' output rows
+static void stbi__resample_seek(stbi__resample *r, stbi_uc *data, int w2, int comp_y, int row)
+{
+   int t = (r->vs >> 1) + row;
+   int wraps = t / r->vs;
+   r->ystep = t % r->vs;
+   r->ypos  = wraps;
+   r->line1 = data + w2 * (wraps < comp_y-1 ? wraps : comp_y-1);
+   r->line0 = wraps == 0 ? data : data + w2 * (wraps-1 < comp_y-1 ? wraps-1 : comp_y-1);
+}
+
+// resamples and color-converts the rows of items [begin,end), STBI__PARALLEL_ROWS rows per item
+static void stbi__jpeg_convert_task(void *context, int begin, int end)
+{
+   stbi__jpeg_convert_job *job = (stbi__jpeg_convert_job *) context;
+   stbi__jpeg *z = job->z;
+   int k, ok = 1;
+   int n = job->n, decode_n = job->decode_n, is_rgb = job->is_rgb;
+   unsigned int i,j;
+   unsigned int first = (unsigned int) begin * STBI__PARALLEL_ROWS;
+   unsigned int last = (unsigned int) end * STBI__PARALLEL_ROWS;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *linebuf[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *spill_row = NULL;
+   stbi__resample res_comp[4];
+
+   if (last > z->s->img_y) last = z->s->img_y;
+   // with n < 4 some paths store a throwaway byte past each pixel (the 4th byte for n == 3, an
+   // alpha for n == 1 from CMYK), which for the last pixel of a row lands on the next row. When
+   // that row belongs to another task, possibly running at the same time, our last row goes
+   // through a scratch row instead
+   if (n < 4 && last < z->s->img_y) {
+      spill_row = (stbi_uc *) stbi__malloc(n * z->s->img_x + 1);
+      if (!spill_row) ok = 0;
+   }
+   for (k=0; k < decode_n; ++k) {
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      linebuf[k] = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!linebuf[k]) ok = 0;
+      res_comp[k] = job->res_comp[k];
+      stbi__resample_seek(&res_comp[k], z->img_comp[k].data, z->img_comp[k].w2, z->img_comp[k].y, (int) first);
+   }
+
+   if (ok) {
+      for (j=first; j < last; ++j) {
+         stbi_uc *dest = job->output + n * z->s->img_x * j;
+         stbi_uc *out = (spill_row && j+1 == last) ? spill_row : dest;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
+            coutput[k] = r->resample(linebuf[k],
                                      y_bot ? r->line1 : r->line0,
                                      y_bot ? r->line0 : r->line1,
                                      r->w_lores, r->hs);
@@ -4016,7 +4683,78 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
             }
          }
+         if (spill_row && j+1 == last)
+            memcpy(dest, spill_row, n * z->s->img_x);
+      }
+   } else {
+      job->failed = 1;
+   }
+   for (k=0; k < decode_n; ++k)
+      STBI_FREE(linebuf[k]);
+   STBI_FREE(spill_row);
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // determine actual number of components to generate
+   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+
+   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+
+   if (z->s->img_n == 3 && n < 3 && !is_rgb)
+      decode_n = 1;
+   else
+      decode_n = z->s->img_n;
+
+   // nothing to do if no components requested; check this now to avoid
+   // accessing uninitialized coutput[0] later
+   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // resample and color-convert
+   {
+      int k;
+      stbi_uc *output;
+      stbi__jpeg_convert_job job;
+
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &job.res_comp[k];
+
+         r->hs      = z->img_h_max / z->img_comp[k].h;
+         r->vs      = z->img_v_max / z->img_comp[k].v;
+         r->ystep   = r->vs >> 1;
+         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+         r->ypos    = 0;
+         r->line0   = r->line1 = z->img_comp[k].data;
+
+         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+         else                               r->resample = stbi__resample_row_generic;
       }
+
+      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+      // now go ahead and resample, in bands of rows that each seek their resamplers to their first row
+      job.z = z;
+      job.output = output;
+      job.n = n;
+      job.decode_n = decode_n;
+      job.is_rgb = is_rgb;
+      job.failed = 0;
+      stbi__parallel_run(stbi__parallel_ok(z->s->img_x, z->s->img_y), stbi__jpeg_convert_task, &job,
+                         (int) ((z->s->img_y + STBI__PARALLEL_ROWS-1) / STBI__PARALLEL_ROWS));
+      if (job.failed) { STBI_FREE(output); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -4088,9 +4826,11 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most codes of dynamic ones
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
+#define STBI__ZPAIR_BITS  11 // lookahead of the table that decodes one or two literals at once
+#define STBI__ZPAIR_MASK  ((1 << STBI__ZPAIR_BITS) - 1)
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
@@ -4179,7 +4919,7 @@ typedef struct
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
    int hit_zeof_once;
-   stbi__uint32 code_buffer;
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
@@ -4187,8 +4927,27 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   // literal fast path, indexed by the next STBI__ZPAIR_BITS bits; 0 means "not one or two literals".
+   // otherwise bits 0-7 and 8-15 hold the literals, bits 16-20 the total code length, bit 24 is set for a pair
+   stbi__uint32 z_literals[1 << STBI__ZPAIR_BITS];
+
+   // if set, the number of output bytes written so far is published here every
+   // STBI__ZPROGRESS_STEP bytes, for a reader on another thread. the output
+   // buffer must not be expandable then, since it can't move under the reader
+   volatile long *zprogress;
+   char *zprogress_next;
 } stbi__zbuf;
 
+#define STBI__ZPROGRESS_STEP  (1 << 16)
+
+static void stbi__zpublish(stbi__zbuf *a, char *zout)
+{
+#ifndef STBI__NO_ATOMICS
+   stbi__atomic_store(a->zprogress, (long) (zout - a->zout_start));
+#endif
+   a->zprogress_next = zout + STBI__ZPROGRESS_STEP;
+}
+
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
    return (z->zbuffer >= z->zbuffer_end);
@@ -4199,14 +4958,41 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
    return stbi__zeof(z) ? 0 : *z->zbuffer++;
 }
 
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+   stbi__uint64 v;
+   memcpy(&v, p, 8);
+   return v;
+#else
+   return  (stbi__uint64) p[0]        | ((stbi__uint64) p[1] <<  8) | ((stbi__uint64) p[2] << 16) | ((stbi__uint64) p[3] << 24) |
+          ((stbi__uint64) p[4] << 32) | ((stbi__uint64) p[5] << 40) | ((stbi__uint64) p[6] << 48) | ((stbi__uint64) p[7] << 56);
+#endif
+}
+
+// with at least 8 bytes of input left, top the bit buffer up to 56+ bits with a single
+// unaligned load instead of a byte at a time
+stbi_inline static void stbi__fill_bits_wide(stbi__zbuf *z)
+{
+   z->code_buffer |= stbi__zload64(z->zbuffer) << z->num_bits;
+   z->zbuffer += (63 - z->num_bits) >> 3;
+   z->num_bits |= 56;
+   // drop the bits of the partially loaded byte; it is loaded again (whole) next time
+   z->code_buffer &= ((stbi__uint64) 1 << z->num_bits) - 1;
+}
+
 static void stbi__fill_bits(stbi__zbuf *z)
 {
+   if (z->zbuffer_end - z->zbuffer >= 8 && z->code_buffer < ((stbi__uint64) 1 << z->num_bits)) {
+      stbi__fill_bits_wide(z);
+      return;
+   }
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
+      if (z->code_buffer >= ((stbi__uint64) 1 << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
         return;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
    } while (z->num_bits <= 24);
 }
@@ -4215,7 +5001,7 @@ stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4226,7 +5012,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4306,11 +5092,57 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// fill in z_literals from the fast table of z_length: every STBI__ZPAIR_BITS bit pattern that
+// starts with one literal code, or with two whose lengths fit in the lookahead together
+static void stbi__zbuild_literals(stbi__zbuf *a)
+{
+   int i;
+   for (i=0; i < (1 << STBI__ZPAIR_BITS); ++i) {
+      stbi__uint32 entry = 0;
+      int b = a->z_length.fast[i & STBI__ZFAST_MASK];
+      if (b && (b & 511) < 256) {
+         int s = b >> 9;
+         int b2 = a->z_length.fast[(i >> s) & STBI__ZFAST_MASK];
+         entry = (stbi__uint32) ((s << 16) | (b & 511));
+         if (b2 && (b2 & 511) < 256 && s + (b2 >> 9) <= STBI__ZPAIR_BITS)
+            entry = (stbi__uint32) ((1 << 24) | ((s + (b2 >> 9)) << 16) | ((b2 & 511) << 8) | (b & 511));
+      }
+      a->z_literals[i] = entry;
+   }
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      if (a->zprogress && zout >= a->zprogress_next) stbi__zpublish(a, zout);
+      // fast path: while there's input for a wide refill, one refill covers several literals or a whole
+      // length/distance pair (at most 15+5+15+13 bits). Runs of literals are decoded from locals, as the
+      // stores through zout could otherwise alias the bit buffer
+      if (a->zbuffer_end - a->zbuffer >= 8) {
+         stbi__uint64 bits;
+         int num_bits;
+         stbi__uint32 entry;
+         char *zout_end = a->zout_end;
+         if (a->num_bits < 48) stbi__fill_bits_wide(a);
+         bits = a->code_buffer;
+         num_bits = a->num_bits;
+         entry = a->z_literals[bits & STBI__ZPAIR_MASK];
+         while (entry && num_bits >= STBI__ZPAIR_BITS && zout_end - zout >= 2) {
+            int s = (entry >> 16) & 31;
+            bits >>= s;
+            num_bits -= s;
+            zout[0] = (char) (entry & 255);
+            zout[1] = (char) ((entry >> 8) & 255);
+            zout += 1 + (entry >> 24);
+            entry = a->z_literals[bits & STBI__ZPAIR_MASK];
+         }
+         a->code_buffer = bits;
+         a->num_bits = num_bits;
+         if (entry && zout_end - zout >= 2) continue; // out of buffered bits; refill
+      }
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4347,8 +5179,18 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+            // the source is at least 8 bytes behind, so copy 8 bytes at a time; the last copy may
+            // spill a few bytes past the match, which there's room for and which get overwritten later
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -4414,7 +5256,7 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
       stbi__zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
       a->code_buffer >>= 8;
       a->num_bits -= 8;
@@ -4426,9 +5268,16 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
       if (!stbi__zexpand(a, a->zout, len)) return 0;
+   // the wide refill can read ahead past the header; bytes still in the bit buffer start the stored data
+   while (a->num_bits > 0 && len > 0) {
+      *a->zout++ = (char) (a->code_buffer & 255);
+      a->code_buffer >>= 8;
+      a->num_bits -= 8;
+      --len;
+   }
+   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
    memcpy(a->zout, a->zbuffer, len);
    a->zbuffer += len;
    a->zout += len;
@@ -4501,8 +5350,10 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         stbi__zbuild_literals(a);
          if (!stbi__parse_huffman_block(a)) return 0;
       }
+      if (a->zprogress) stbi__zpublish(a, a->zout);
    } while (!final);
    return 1;
 }
@@ -4513,6 +5364,7 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->zprogress  = NULL;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4667,6 +5519,123 @@ static int stbi__paeth(int a, int b, int c)
    return t1;
 }
 
+#ifdef STBI_SSE2
+// SSE2 unfiltering. Up has no dependency along the row and goes 16 bytes at a time; Sub, Avg and Paeth
+// depend on the pixel to the left, so they go a pixel at a time, with all bytes of the pixel in parallel.
+// With a = c = 0 for the first pixel these produce the same result as the scalar first-pixel cases.
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+   if (n == 8) {
+      return _mm_loadl_epi64((const __m128i *) p);
+   } else if (n == 4) {
+      int v;
+      memcpy(&v, p, 4);
+      return _mm_cvtsi32_si128(v);
+   } else {
+      stbi_uc buf[8] = { 0 };
+      memcpy(buf, p, n);
+      return _mm_loadl_epi64((const __m128i *) buf);
+   }
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n)
+{
+   if (n == 8) {
+      _mm_storel_epi64((__m128i *) p, v);
+   } else if (n == 4) {
+      int x = _mm_cvtsi128_si32(v);
+      memcpy(p, &x, 4);
+   } else {
+      stbi_uc buf[8];
+      _mm_storel_epi64((__m128i *) buf, v);
+      memcpy(p, buf, n);
+   }
+}
+
+// one pixel of Sub, Avg or Paeth; a and c carry the left and upper-left pixels (as 16-bit lanes for Paeth)
+stbi_inline static void stbi__png_unfilter_pixel_sse2(int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, __m128i *a, __m128i *c, int n)
+{
+   if (filter == STBI__F_sub) {
+      *a = _mm_add_epi8(*a, stbi__png_load_pixel(raw, n));
+      stbi__png_store_pixel(cur, *a, n);
+   } else if (filter == STBI__F_avg) {
+      __m128i b = stbi__png_load_pixel(prior, n);
+      // (a+b)>>1 without overflow: pavgb rounds up, so take off the carried-in low bit
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(*a, b), _mm_and_si128(_mm_xor_si128(*a, b), _mm_set1_epi8(1)));
+      *a = _mm_add_epi8(stbi__png_load_pixel(raw, n), avg);
+      stbi__png_store_pixel(cur, *a, n);
+   } else {
+      // Paeth on 16-bit lanes so the differences can't overflow; ties pick a over b over c as in the spec
+      __m128i zero = _mm_setzero_si128();
+      __m128i b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior, n), zero);
+      __m128i x = _mm_unpacklo_epi8(stbi__png_load_pixel(raw, n), zero);
+      __m128i pa = _mm_sub_epi16(b, *c); // p-a = b-c
+      __m128i pb = _mm_sub_epi16(*a, *c); // p-b = a-c
+      __m128i pc = _mm_add_epi16(pa, pb); // p-c = (a-c)+(b-c)
+      __m128i smallest, use_a, use_b, nearest;
+      pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+      pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+      pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+      use_a = _mm_cmpeq_epi16(smallest, pa);
+      use_b = _mm_cmpeq_epi16(smallest, pb);
+      nearest = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, *c));
+      nearest = _mm_or_si128(_mm_and_si128(use_a, *a), _mm_andnot_si128(use_a, nearest));
+      // add bytewise so the sum wraps mod 256; the high byte of every lane stays 0
+      *a = _mm_add_epi8(x, nearest);
+      *c = b;
+      stbi__png_store_pixel(cur, _mm_packus_epi16(*a, *a), n);
+   }
+}
+
+// n is the pixel size; wide is n rounded up to a whole load (3 -> 4, 6 -> 8). All but the last pixel are
+// read and written wide: the extra bytes read are still inside the row buffers, and the extra byte written
+// belongs to the next pixel, which is written again right after.
+stbi_inline static void stbi__png_unfilter_pixels_sse2(int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int nk, int n, int wide)
+{
+   __m128i a = _mm_setzero_si128(), c = _mm_setzero_si128();
+   int k;
+   // spelled out per filter so each loop inlines a single filter
+   if (filter == STBI__F_sub) {
+      for (k = 0; k < nk - n; k += n)
+         stbi__png_unfilter_pixel_sse2(STBI__F_sub, cur+k, raw+k, prior+k, &a, &c, wide);
+   } else if (filter == STBI__F_avg) {
+      for (k = 0; k < nk - n; k += n)
+         stbi__png_unfilter_pixel_sse2(STBI__F_avg, cur+k, raw+k, prior+k, &a, &c, wide);
+   } else {
+      for (k = 0; k < nk - n; k += n)
+         stbi__png_unfilter_pixel_sse2(STBI__F_paeth, cur+k, raw+k, prior+k, &a, &c, wide);
+   }
+   stbi__png_unfilter_pixel_sse2(filter, cur+k, raw+k, prior+k, &a, &c, n);
+}
+
+// unfilters one scanline if there is an SSE2 version for this filter and pixel size; returns 0 if not
+static int stbi__png_unfilter_sse2(int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int nk, int filter_bytes)
+{
+   if (filter == STBI__F_up) {
+      int k = 0;
+      for (; k + 16 <= nk; k += 16) {
+         __m128i x = _mm_loadu_si128((const __m128i *) (raw+k));
+         __m128i b = _mm_loadu_si128((const __m128i *) (prior+k));
+         _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(x, b));
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      return 1;
+   }
+   if (filter != STBI__F_sub && filter != STBI__F_avg && filter != STBI__F_paeth)
+      return 0;
+   // one and two byte pixels have too little work per step to beat the scalar loops
+   switch (filter_bytes) {
+      case 3: stbi__png_unfilter_pixels_sse2(filter, cur, raw, prior, nk, 3, 4); return 1;
+      case 4: stbi__png_unfilter_pixels_sse2(filter, cur, raw, prior, nk, 4, 4); return 1;
+      case 6: stbi__png_unfilter_pixels_sse2(filter, cur, raw, prior, nk, 6, 8); return 1;
+      case 8: stbi__png_unfilter_pixels_sse2(filter, cur, raw, prior, nk, 8, 8); return 1;
+   }
+   return 0;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // adds an extra all-255 alpha channel
@@ -4692,41 +5661,21 @@ static void stbi__create_png_alpha_expand8(stbi_uc *dest, stbi_uc *src, stbi__ui
    }
 }
 
-// create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// unfilters rows [j_begin, j_end) of raw into a->out, expanding bit depths and adding alpha as it goes.
+// filter_buf carries the previous row from one call to the next, so the rows must be handed over in
+// order. returns 0 on an invalid filter byte without setting an error, so it can run off the calling thread
+static int stbi__create_png_rows(stbi__png *a, stbi_uc *raw, stbi_uc *filter_buf, int out_n, stbi__uint32 x, stbi__uint32 j_begin, stbi__uint32 j_end, int depth, int color)
 {
    int bytes = (depth == 16 ? 2 : 1);
-   stbi__context *s = a->s;
+   int img_n = a->s->img_n;
    stbi__uint32 i,j,stride = x*out_n*bytes;
-   stbi__uint32 img_len, img_width_bytes;
-   stbi_uc *filter_buf;
-   int all_ok = 1;
-   int k;
-   int img_n = s->img_n; // copy it into a local for later
-
-   int output_bytes = out_n*bytes;
+   stbi__uint32 img_width_bytes = (((img_n * x * depth) + 7) >> 3);
    int filter_bytes = img_n*bytes;
    int width = x;
-
-   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-   if (!a->out) return stbi__err("outofmem", "Out of memory");
-
-   // note: error exits here don't need to clean up a->out individually,
-   // stbi__do_png always does on error.
-   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
-   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-   if (!stbi__mad2sizes_valid(img_width_bytes, y, img_width_bytes)) return stbi__err("too large", "Corrupt PNG");
-   img_len = (img_width_bytes + 1) * y;
-
-   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-   // so just check for raw_len < img_len always.
-   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
-
-   // Allocate two scan lines worth of filter workspace buffer.
-   filter_buf = (stbi_uc *) stbi__malloc_mad2(img_width_bytes, 2, 0);
-   if (!filter_buf) return stbi__err("outofmem", "Out of memory");
+   int k;
+#ifdef STBI_SSE2
+   int use_sse2 = stbi__sse2_available();
+#endif
 
    // Filtering for low-bit-depth images
    if (depth < 8) {
@@ -4734,7 +5683,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       width = img_width_bytes;
    }
 
-   for (j=0; j < y; ++j) {
+   raw += (size_t) j_begin * (img_width_bytes + 1);
+
+   for (j=j_begin; j < j_end; ++j) {
       // cur/prior filter buffers alternate
       stbi_uc *cur = filter_buf + (j & 1)*img_width_bytes;
       stbi_uc *prior = filter_buf + (~j & 1)*img_width_bytes;
@@ -4743,15 +5694,18 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       int filter = *raw++;
 
       // check filter type
-      if (filter > 4) {
-         all_ok = stbi__err("invalid filter","Corrupt PNG");
-         break;
-      }
+      if (filter > 4)
+         return 0;
 
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
       // perform actual filtering
+#ifdef STBI_SSE2
+      if (use_sse2 && stbi__png_unfilter_sse2(filter, cur, raw, prior, nk, filter_bytes)) {
+         // done
+      } else
+#endif
       switch (filter) {
       case STBI__F_none:
          memcpy(cur, raw, nk);
@@ -4852,8 +5806,53 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
+   return 1;
+}
+
+// allocates a->out and the two-row filter workspace for an x*y image
+static stbi_uc *stbi__create_png_buffers(stbi__png *a, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, stbi__uint32 *img_len)
+{
+   int bytes = (depth == 16 ? 2 : 1);
+   int img_n = a->s->img_n;
+   stbi__uint32 img_width_bytes;
+   stbi_uc *filter_buf;
+
+   STBI_ASSERT(out_n == a->s->img_n || out_n == a->s->img_n+1);
+   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, out_n*bytes, 0); // extra bytes to write off the end into
+   if (!a->out) return (stbi_uc *) stbi__errpuc("outofmem", "Out of memory");
+
+   // note: error exits here don't need to clean up a->out individually,
+   // stbi__do_png always does on error.
+   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return (stbi_uc *) stbi__errpuc("too large", "Corrupt PNG");
+   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   if (!stbi__mad2sizes_valid(img_width_bytes, y, img_width_bytes)) return (stbi_uc *) stbi__errpuc("too large", "Corrupt PNG");
+   *img_len = (img_width_bytes + 1) * y;
+
+   // Allocate two scan lines worth of filter workspace buffer.
+   filter_buf = (stbi_uc *) stbi__malloc_mad2(img_width_bytes, 2, 0);
+   if (!filter_buf) return (stbi_uc *) stbi__errpuc("outofmem", "Out of memory");
+   return filter_buf;
+}
+
+// create the png data from post-deflated data
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   stbi__uint32 img_len;
+   stbi_uc *filter_buf = stbi__create_png_buffers(a, out_n, x, y, depth, &img_len);
+   int all_ok;
+   if (!filter_buf) return 0;
+
+   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+   // so just check for raw_len < img_len always.
+   if (raw_len < img_len) {
+      STBI_FREE(filter_buf);
+      return stbi__err("not enough pixels","Corrupt PNG");
+   }
+
+   all_ok = stbi__create_png_rows(a, raw, filter_buf, out_n, x, 0, y, depth, color);
    STBI_FREE(filter_buf);
-   if (!all_ok) return 0;
+   if (!all_ok) return stbi__err("invalid filter","Corrupt PNG");
 
    return 1;
 }
@@ -4903,6 +5902,110 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
+#ifndef STBI__NO_ATOMICS
+// inflate and unfiltering overlapped: one task inflates while another unfilters
+// each row as soon as it has been inflated
+typedef struct
+{
+   stbi__png *a;
+   stbi__zbuf z;
+   int parse_header;
+   stbi_uc *filter_buf;
+   int out_n, depth, color;
+   long row_bytes;
+   volatile long roles;      // tasks started so far; the first one inflates
+   volatile long produced;   // bytes inflated so far
+   volatile long inflated;   // 0 while inflating, then 1 on success or -1 on failure
+   int rows_ok;
+} stbi__png_pipeline;
+
+static void stbi__png_pipeline_task(void *context, int begin, int end)
+{
+   stbi__png_pipeline *p = (stbi__png_pipeline *) context;
+   stbi__uint32 y = p->a->s->img_y;
+   for (; begin < end; ++begin) {
+      if (stbi__atomic_increment(&p->roles) == 1) {
+         // inflate errors land in this thread's failure reason; the caller redoes a failed image serially
+         int ok = stbi__parse_zlib(&p->z, p->parse_header);
+         stbi__atomic_store(&p->produced, (long) (p->z.zout - p->z.zout_start));
+         stbi__atomic_store(&p->inflated, ok ? 1L : -1L);
+      } else {
+         // whichever task comes second has the inflate running (or done) already, so waiting can't deadlock
+         stbi__uint32 j = 0;
+         while (j < y) {
+            long inflated = stbi__atomic_load(&p->inflated);
+            stbi__uint32 ready = (stbi__uint32) (stbi__atomic_load(&p->produced) / p->row_bytes);
+            if (ready > y) ready = y;
+            if (ready > j) {
+               if (!stbi__create_png_rows(p->a, (stbi_uc *) p->z.zout_start, p->filter_buf, p->out_n, p->a->s->img_x, j, ready, p->depth, p->color))
+                  break;
+               j = ready;
+            } else if (inflated != 0) {
+               break; // failed, or ran out of data before the last row
+            } else {
+               stbi__spin_pause();
+            }
+         }
+         p->rows_ok = (j == y);
+      }
+   }
+}
+#endif
+
+// decodes a non-interlaced image straight from the compressed IDATs, unfiltering rows
+// while the rest are still being inflated. returns 0 (with a->out and the inflate buffer
+// freed) if it can't, so the caller can fall back to the serial path
+static int stbi__create_png_image_pipelined(stbi__png *a, stbi_uc *idata, stbi__uint32 idata_len, int parse_header, int out_n, int depth, int color)
+{
+#ifdef STBI__NO_ATOMICS
+   STBI_NOTUSED(a); STBI_NOTUSED(idata); STBI_NOTUSED(idata_len); STBI_NOTUSED(parse_header);
+   STBI_NOTUSED(out_n); STBI_NOTUSED(depth); STBI_NOTUSED(color);
+   return 0;
+#else
+   stbi__png_pipeline p;
+   stbi__uint32 img_len;
+   stbi_uc *expanded;
+   if (!stbi__parallel_ok(a->s->img_x, a->s->img_y)) return 0;
+   memset(&p, 0, sizeof(p));
+   p.filter_buf = stbi__create_png_buffers(a, out_n, a->s->img_x, a->s->img_y, depth, &img_len);
+   if (!p.filter_buf) {
+      STBI_FREE(a->out); a->out = NULL;
+      return 0;
+   }
+   // the rows are read while the rest is inflated, so the buffer has to have its final size up front. a stream
+   // with extra data after the image (see issue #276) overflows it and is redone by the serial path
+   expanded = (stbi_uc *) stbi__malloc(img_len);
+   if (!expanded) {
+      STBI_FREE(p.filter_buf);
+      STBI_FREE(a->out); a->out = NULL;
+      return 0;
+   }
+   p.a = a;
+   p.parse_header = parse_header;
+   p.out_n = out_n;
+   p.depth = depth;
+   p.color = color;
+   p.row_bytes = (long) (img_len / a->s->img_y);
+   p.z.zbuffer = idata;
+   p.z.zbuffer_end = idata + idata_len;
+   p.z.zout_start = p.z.zout = (char *) expanded;
+   p.z.zout_end = (char *) expanded + img_len;
+   p.z.z_expandable = 0;
+   p.z.zprogress = &p.produced;
+   p.z.zprogress_next = p.z.zout + STBI__ZPROGRESS_STEP;
+
+   stbi__parallel_run(1, stbi__png_pipeline_task, &p, 2);
+
+   STBI_FREE(p.filter_buf);
+   STBI_FREE(expanded);
+   if (p.inflated != 1 || !p.rows_ok) {
+      STBI_FREE(a->out); a->out = NULL;
+      return 0;
+   }
+   return 1;
+#endif
+}
+
 static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
 {
    stbi__context *s = z->s;
@@ -5201,17 +6304,19 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            if (interlace || !stbi__create_png_image_pipelined(z, z->idata, ioff, !is_iphone, s->img_out_n, z->depth, color)) {
+               // initial guess for decoded data size to avoid unnecessary reallocs
+               bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
+               raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+               z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+               if (z->expanded == NULL) return 0; // zlib should set error
+               if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            }
+            STBI_FREE(z->idata); z->idata = NULL;
             if (has_trans) {
                if (z->depth == 16) {
                   if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
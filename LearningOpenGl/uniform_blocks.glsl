@@ -0,0 +1,13 @@
+// The uniform blocks every program shares, mirrored by UniformBlocks.h: the per-frame camera and the per-object
+// transform.
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;    // xyz, w unused
+};
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;      // transpose(inverse(mat3(model))) in the upper 3x3
+};
@@ -0,0 +1,43 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// set by VirtualTextureSystem::Bind
+uniform sampler2D vtPhysical;           // the page cache
+uniform usampler2DArray vtIndirection;  // per level and tile: page x, page y, level of the page, valid
+uniform vec2 vtSize;                    // texels across level 0
+uniform int vtLevelCount;
+uniform float vtPagesAcross;
+
+const float TILE_SIZE = 128.0;
+const float TILE_BORDER = 4.0;
+const float PAGE_SIZE = TILE_SIZE + 2.0 * TILE_BORDER;
+
+// the mip level a regular mipmapped texture of vtSize would sample here
+float virtualLevel(vec2 uv)
+{
+    vec2 dx = dFdx(uv * vtSize);
+    vec2 dy = dFdy(uv * vtSize);
+    return max(0.0, 0.5 * log2(max(dot(dx, dx), dot(dy, dy))));
+}
+
+vec4 sampleVirtual(vec2 uv)
+{
+    int level = min(int(virtualLevel(uv)), vtLevelCount - 1);
+    uv = fract(uv);
+    // find the tile we want, and through the indirection the page of the closest resident tile covering it
+    vec2 levelSize = max(floor(vtSize / exp2(float(level))), vec2(1.0));
+    ivec2 tile = ivec2(uv * levelSize / TILE_SIZE);
+    uvec4 entry = texelFetch(vtIndirection, ivec3(tile, level), 0);
+    vec2 residentSize = max(floor(vtSize / exp2(float(entry.b))), vec2(1.0));
+    vec2 texel = uv * residentSize;
+    vec2 inTile = texel - floor(texel / TILE_SIZE) * TILE_SIZE;
+    vec2 physical = (vec2(entry.rg) * PAGE_SIZE + TILE_BORDER + inTile) / (vtPagesAcross * PAGE_SIZE);
+    return textureLod(vtPhysical, physical, 0.0);
+}
+
+void main()
+{
+    FragColor = sampleVirtual(TexCoords);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+#include "uniform_blocks.glsl"
+
+void main()
+{
+    TexCoords = aTexCoords;
+    gl_Position = viewProjection * (model * vec4(aPos, 1.0));
+}
@@ -0,0 +1,24 @@
+#version 330 core
+// which tile of which virtual texture this pixel needs, read back by VirtualTextureSystem
+layout (location = 0) out uvec4 Feedback;
+
+in vec2 TexCoords;
+
+// set by VirtualTextureSystem::Bind
+uniform vec2 vtSize;
+uniform int vtLevelCount;
+uniform int vtId;
+uniform float vtFeedbackBias;   // undoes the feedback pass rendering at a lower resolution
+
+const float TILE_SIZE = 128.0;
+
+void main()
+{
+    vec2 dx = dFdx(TexCoords * vtSize);
+    vec2 dy = dFdy(TexCoords * vtSize);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vtFeedbackBias;
+    int level = clamp(int(lod), 0, vtLevelCount - 1);
+    vec2 levelSize = max(floor(vtSize / exp2(float(level))), vec2(1.0));
+    ivec2 tile = ivec2(fract(TexCoords) * levelSize / TILE_SIZE);
+    Feedback = uvec4(uvec2(tile), uint(level), uint(vtId));
+}